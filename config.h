@@ -10,8 +10,8 @@
 /* Define to 1 if you have the <fcntl.h> header file. */
 #define HAVE_FCNTL_H 1
 
-/* Define to 1 if you have the <fuse.h> header file. */
-#define HAVE_FUSE_H 1
+/* Define to 1 if you have the <fuse3/fuse_lowlevel.h> header file. */
+#define HAVE_FUSE3_FUSE_LOWLEVEL_H 1
 
 /* Define to 1 if you have the <inttypes.h> header file. */
 #define HAVE_INTTYPES_H 1
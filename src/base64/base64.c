@@ -21,6 +21,8 @@
  */
  
 #include <base64.h>
+#include <string.h>
+#include <stdint.h>
  
 private const uchar base64_alphabets[2][64] = {
 		//RFC 3548 alphabet
@@ -70,6 +72,348 @@ private const ubyte base64_alphabets_reverse[2][256] = {
 	}
 };
 	
+/*
+ * SIMD kernels of the filename safe alphabet (the alphabet of the encrypted names). A kernel
+ * encodes or decodes the first part of the input in blocks and returns the bytes (or chars) done,
+ * the scalar code does the rest. The decode kernels stop at the first block that contains a char
+ * that is not in the alphabet ('=' too), so the scalar code handles the extraneous symbols and the
+ * padding like before. The kernel is selected at startup with the features of the cpu.
+ */
+
+typedef size_t (*base64_kernel_t)(const ubyte* in, size_t len_in, ubyte* out);
+
+/** Kernel that does nothing, for the scalar implementation */
+private size_t base64_kernelNone(const ubyte* in, size_t len_in, ubyte* out)
+{
+	(void)in;
+	(void)len_in;
+	(void)out;
+	return 0;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#include <immintrin.h>
+
+/** Translate 6 bits values to the chars of the filename safe alphabet
+ *
+ * The values 0..51 become 0, 52..61 become 1..10, 62 becomes 11 and 63 becomes 12, then the values
+ * 0..25 become 13. The result selects the offset to add to the value.
+ */
+__attribute__((target("sse4.1")))
+private inline __m128i base64_toAscii128(__m128i v)
+{
+	__m128i idx, less, shift;
+
+	idx = _mm_subs_epu8(v, _mm_set1_epi8(51));
+	less = _mm_cmpgt_epi8(_mm_set1_epi8(26), v);
+	idx = _mm_or_si128(idx, _mm_and_si128(less, _mm_set1_epi8(13)));
+	shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+						  '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0);
+
+	return _mm_add_epi8(_mm_shuffle_epi8(shift, idx), v);
+}
+
+/** Split every 3 bytes (in the order 1 0 2 1 of the 32 bits words) in 4 values of 6 bits */
+__attribute__((target("sse4.1")))
+private inline __m128i base64_split128(__m128i in)
+{
+	__m128i t0, t1;
+
+	t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+	t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+
+	return _mm_or_si128(t0, t1);
+}
+
+/** Translate the chars of the filename safe alphabet to their 6 bits values
+ *
+ * @param valid the mask of the chars that are in the alphabet ('=' is not)
+ */
+__attribute__((target("sse4.1")))
+private inline __m128i base64_fromAscii128(__m128i c, int* valid)
+{
+	__m128i upper, lower, digit, dash, underscore, shift;
+
+	upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)),
+						  _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), c));
+	lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+						  _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), c));
+	digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+						  _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+	dash = _mm_cmpeq_epi8(c, _mm_set1_epi8('-'));
+	underscore = _mm_cmpeq_epi8(c, _mm_set1_epi8('_'));
+
+	*valid = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower),
+											_mm_or_si128(digit, _mm_or_si128(dash, underscore))));
+
+	shift = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+						 _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+	shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+	shift = _mm_or_si128(shift, _mm_and_si128(dash, _mm_set1_epi8(62 - '-')));
+	shift = _mm_or_si128(shift, _mm_and_si128(underscore, _mm_set1_epi8(63 - '_')));
+
+	return _mm_add_epi8(c, shift);
+}
+
+/** Join every 4 values of 6 bits in 3 bytes, in the low 24 bits of the 32 bits words */
+__attribute__((target("sse4.1")))
+private inline __m128i base64_join128(__m128i v)
+{
+	v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+	return _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+}
+
+/** Encode 12 bytes in 16 chars, 16 bytes of the input are read */
+__attribute__((target("sse4.1")))
+private size_t base64_encodeSse41(const ubyte* in, size_t len_in, ubyte* out)
+{
+	__m128i v;
+	size_t i;
+
+	for(i = 0; len_in - i >= 16; i += 12, out += 16){
+		v = _mm_loadu_si128((const __m128i*)(in + i));
+		v = _mm_shuffle_epi8(v, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+		_mm_storeu_si128((__m128i*)out, base64_toAscii128(base64_split128(v)));
+	}
+
+	return i;
+}
+
+/** Decode 16 chars in 12 bytes */
+__attribute__((target("sse4.1")))
+private size_t base64_decodeSse41(const ubyte* in, size_t len_in, ubyte* out)
+{
+	__m128i v;
+	int valid;
+	uint32_t last;
+	size_t i;
+
+	for(i = 0; len_in - i >= 16; i += 16, out += 12){
+		v = base64_fromAscii128(_mm_loadu_si128((const __m128i*)(in + i)), &valid);
+		if(valid != 0xFFFF) break;
+		v = _mm_shuffle_epi8(base64_join128(v), _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+															  -1, -1, -1, -1));
+		//only 12 bytes are written, the output has not space for more
+		_mm_storel_epi64((__m128i*)out, v);
+		last = _mm_extract_epi32(v, 2);
+		memcpy(out + 8, &last, 4);
+	}
+
+	return i;
+}
+
+/** Encode 24 bytes in 32 chars, 28 bytes of the input are read */
+__attribute__((target("avx2")))
+private size_t base64_encodeAvx2(const ubyte* in, size_t len_in, ubyte* out)
+{
+	__m256i v, t0, t1, idx, less, shift;
+	size_t i;
+
+	for(i = 0; len_in - i >= 28; i += 24, out += 32){
+		v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(in + i))),
+									_mm_loadu_si128((const __m128i*)(in + i + 12)), 1);
+		v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+													 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+
+		//see base64_split128 and base64_toAscii128
+		t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0FC0FC00)),
+								_mm256_set1_epi32(0x04000040));
+		t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003F03F0)),
+								_mm256_set1_epi32(0x01000010));
+		v = _mm256_or_si256(t0, t1);
+
+		idx = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+		less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+		idx = _mm256_or_si256(idx, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+		shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+								 '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63,
+								 'A', 0, 0,
+								 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+								 '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63,
+								 'A', 0, 0);
+		v = _mm256_add_epi8(_mm256_shuffle_epi8(shift, idx), v);
+
+		_mm256_storeu_si256((__m256i*)out, v);
+	}
+
+	return i + base64_encodeSse41(in + i, len_in - i, out);
+}
+
+/** Decode 32 chars in 24 bytes */
+__attribute__((target("avx2")))
+private size_t base64_decodeAvx2(const ubyte* in, size_t len_in, ubyte* out)
+{
+	__m256i c, v, upper, lower, digit, dash, underscore, shift;
+	size_t i;
+
+	for(i = 0; len_in - i >= 32; i += 32, out += 24){
+		//see base64_fromAscii128
+		c = _mm256_loadu_si256((const __m256i*)(in + i));
+		upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)),
+								 _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+		lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)),
+								 _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+		digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+								 _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+		dash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'));
+		underscore = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_'));
+		if(_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(upper, lower),
+							_mm256_or_si256(digit, _mm256_or_si256(dash, underscore)))) != -1){
+			break;
+		}
+
+		shift = _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+								_mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(dash, _mm256_set1_epi8(62 - '-')));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(underscore, _mm256_set1_epi8(63 - '_')));
+		v = _mm256_add_epi8(c, shift);
+
+		//see base64_join128, then the 12 bytes of every lane are moved together
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+		v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+		v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+													-1, -1, -1, -1,
+													2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+													-1, -1, -1, -1));
+		v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+		_mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(v));
+		_mm_storel_epi64((__m128i*)(out + 16), _mm256_extracti128_si256(v, 1));
+	}
+
+	return i + base64_decodeSse41(in + i, len_in - i, out);
+}
+
+/** Values of the chars 0..127 in the filename safe alphabet, 0x80 for the other chars */
+private const ubyte base64_vbmiReverse[128] __attribute__((aligned(64))) = {
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 62, 0x80, 0x80,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0x80, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0x80, 0x80, 0x80, 0x80, 63,
+	0x80, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 0x80, 0x80, 0x80, 0x80, 0x80
+};
+
+/** Encode 48 bytes in 64 chars
+ *
+ * Every 3 bytes are copied in a 32 bits word in the order 1 0 2 1, then vpmultishiftqb takes the 4
+ * values of 6 bits and vpermb translates them with the alphabet.
+ */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+private size_t base64_encodeAvx512Vbmi(const ubyte* in, size_t len_in, ubyte* out)
+{
+	__m512i v, order, alphabet;
+	size_t i;
+
+	order = _mm512_setr_epi32(0x01020001, 0x04050304, 0x07080607, 0x0A0B090A, 0x0D0E0C0D, 0x10110F10,
+							  0x13141213, 0x16171516, 0x191A1819, 0x1C1D1B1C, 0x1F201E1F, 0x22232122,
+							  0x25262425, 0x28292728, 0x2B2C2A2B, 0x2E2F2D2E);
+	alphabet = _mm512_loadu_si512((const void*)base64_alphabets[1]);
+
+	for(i = 0; len_in - i >= 48; i += 48, out += 64){
+		v = _mm512_maskz_loadu_epi8(0x0000FFFFFFFFFFFFULL, in + i);
+		v = _mm512_permutexvar_epi8(order, v);
+		v = _mm512_multishift_epi64_epi8(_mm512_set1_epi64(0x3036242A1016040AULL), v);
+		_mm512_storeu_si512((void*)out, _mm512_permutexvar_epi8(v, alphabet));
+	}
+
+	return i + base64_encodeAvx2(in + i, len_in - i, out);
+}
+
+/** Decode 64 chars in 48 bytes
+ *
+ * vpermi2b translates the chars with base64_vbmiReverse, the chars that are not in the alphabet
+ * have the high bit set in the char or in its value.
+ */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+private size_t base64_decodeAvx512Vbmi(const ubyte* in, size_t len_in, ubyte* out)
+{
+	__m512i c, v, reverse0, reverse1, order;
+	size_t i;
+
+	reverse0 = _mm512_load_si512((const void*)base64_vbmiReverse);
+	reverse1 = _mm512_load_si512((const void*)(base64_vbmiReverse + 64));
+	//the 3 bytes of every 32 bits word in the order 2 1 0
+	order = _mm512_setr_epi32(0x06000102, 0x090A0405, 0x0C0D0E08, 0x16101112, 0x191A1415, 0x1C1D1E18,
+							  0x26202122, 0x292A2425, 0x2C2D2E28, 0x36303132, 0x393A3435, 0x3C3D3E38,
+							  0, 0, 0, 0);
+
+	for(i = 0; len_in - i >= 64; i += 64, out += 48){
+		c = _mm512_loadu_si512((const void*)(in + i));
+		v = _mm512_permutex2var_epi8(reverse0, c, reverse1);
+		if(_mm512_movepi8_mask(_mm512_or_si512(c, v)) != 0) break;
+
+		//see base64_join128
+		v = _mm512_maddubs_epi16(v, _mm512_set1_epi32(0x01400140));
+		v = _mm512_madd_epi16(v, _mm512_set1_epi32(0x00011000));
+		v = _mm512_permutexvar_epi8(order, v);
+		_mm512_mask_storeu_epi8(out, 0x0000FFFFFFFFFFFFULL, v);
+	}
+
+	return i + base64_decodeAvx2(in + i, len_in - i, out);
+}
+
+#endif
+
+private base64_kernel_t base64_encodeKernel = base64_kernelNone;
+private base64_kernel_t base64_decodeKernel = base64_kernelNone;
+private int base64_bestImpl = base64_IMPL_SCALAR;
+
+/** Select the best kernels for the cpu, it runs when the program starts */
+__attribute__((constructor))
+private void base64_selectImpl(void)
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512bw")){
+		base64_bestImpl = base64_IMPL_AVX512VBMI;
+	}else if(__builtin_cpu_supports("avx2")){
+		base64_bestImpl = base64_IMPL_AVX2;
+	}else if(__builtin_cpu_supports("sse4.1")){
+		base64_bestImpl = base64_IMPL_SSE41;
+	}
+#endif
+	base64_useImpl(base64_bestImpl);
+}
+
+/** Choose the implementation of the filename safe alphabet, for testing them
+ *
+ * @param impl one of the base64_IMPL_* constants
+ *
+ * @return the implementation used, impl or the best one supported by the cpu if it is lower
+ */
+int base64_useImpl(int impl)
+{
+	if(impl > base64_bestImpl) impl = base64_bestImpl;
+
+	switch(impl){
+#if defined(__GNUC__) && defined(__x86_64__)
+		case base64_IMPL_AVX512VBMI:
+			base64_encodeKernel = base64_encodeAvx512Vbmi;
+			base64_decodeKernel = base64_decodeAvx512Vbmi;
+			break;
+		case base64_IMPL_AVX2:
+			base64_encodeKernel = base64_encodeAvx2;
+			base64_decodeKernel = base64_decodeAvx2;
+			break;
+		case base64_IMPL_SSE41:
+			base64_encodeKernel = base64_encodeSse41;
+			base64_decodeKernel = base64_decodeSse41;
+			break;
+#endif
+		default:
+			impl = base64_IMPL_SCALAR;
+			base64_encodeKernel = base64_kernelNone;
+			base64_decodeKernel = base64_kernelNone;
+	}
+
+	return impl;
+}
+
 /** Decode a base64 string.
  * 
  * <b>Extraneous Symbols</b>
@@ -108,14 +452,39 @@ private const ubyte base64_alphabets_reverse[2][256] = {
  * 		   in both cases.
  */
 bool base64_decode(uchar* in, ubyte** out, size_t len_in, size_t* len_out, base64_opt_t opt)
+{
+	*out = malloc(base64_decodedMaxLength(len_in));
+	if (*out == NULL) return false;
+
+	if(!base64_decodeBuf(in, *out, len_in, len_out, opt)){
+		free(*out);
+		return false;
+	}
+
+	return true;
+}
+
+/** Decode a base64 string in a buffer of the caller, see base64_decode.
+ *
+ * @param out the buffer for the decoded string, at least base64_decodedMaxLength(len_in) bytes
+ *
+ * @return if true the decode have success, false if the input string was corrupted
+ */
+bool base64_decodeBuf(uchar* in, ubyte* out, size_t len_in, size_t* len_out, base64_opt_t opt)
 {
 	uchar in_block[4], in_valid[4], c;
 	ubyte alphabet, *out_pos;
-	size_t real_len_in, len_out_l;
-	int i,j;
+	size_t real_len_in, len_out_l, done;
+	size_t i, j;
 
 	alphabet = (opt & base64_OPT_FILENAMESAFE) ? 1 : 0;
 	
+	//the kernel decodes the first chars, the rest starts from the first block that it can't decode
+	done = (alphabet == 1) ? base64_decodeKernel(in, len_in, out) : 0;
+	in += done;
+	len_in -= done;
+	out += done / 4 * 3;
+	
 	for(j = 0, real_len_in = 0, i = 0; i < len_in; i++){
 		//we skip the exraneous symbols
 		if(base64_alphabets_reverse[alphabet][in[i]] != 255){
@@ -132,13 +501,14 @@ bool base64_decode(uchar* in, ubyte** out, size_t len_in, size_t* len_out, base6
 		}
 	}
 	
-	if (((real_len_in % 4) != 0) || (real_len_in == 0)) return false;
+	if (((real_len_in % 4) != 0) || (real_len_in == 0 && done == 0)) return false;
 	len_out_l = real_len_in / 4 * 3;
-	if(in_valid[2] == '=') len_out_l -= 2;
-	else if(in_valid[3] == '=') len_out_l--;
+	if(real_len_in > 0){
+		if(in_valid[2] == '=') len_out_l -= 2;
+		else if(in_valid[3] == '=') len_out_l--;
+	}
 	
-	*out = out_pos = malloc(len_out_l);
-	if (*out == NULL) return false;
+	out_pos = out;
 
 	for(j = 0, i = 0; i < len_in; i++){
 		/*if(in[i] >= 'A' && in[i] <= 'Z') c = in[i] - 'A';
@@ -178,7 +548,7 @@ bool base64_decode(uchar* in, ubyte** out, size_t len_in, size_t* len_out, base6
 		
 	}
 	
-	*len_out = len_out_l;
+	*len_out = done / 4 * 3 + len_out_l;
 	
 	return true;
 }
@@ -219,25 +589,56 @@ bool base64_decode(uchar* in, ubyte** out, size_t len_in, size_t* len_out, base6
  * 		   allocated for the output.
  */
 bool base64_encode(ubyte* in, uchar** out, size_t len_in, size_t* len_out, base64_opt_t opt)
+{
+	*out = (uchar*)malloc(base64_encodedLength(len_in, opt) + 1);
+	if (*out == NULL) return false;
+
+	return base64_encodeBuf(in, *out, len_in, len_out, opt);
+}
+
+/** Returns the length of the encoded string of len_in bytes, the '\0' char is not included */
+size_t base64_encodedLength(size_t len_in, base64_opt_t opt)
+{
+	size_t len_out;
+
+	len_out = (len_in + 2) / 3 * 4;
+	if(opt & base64_OPT_LINEWRAPPING) len_out += len_out / base64_LINE_LENGTH;
+
+	return len_out;
+}
+
+/** Encode a binary string in a buffer of the caller, see base64_encode.
+ *
+ * @param out the buffer for the encoded string, at least base64_encodedLength(len_in, opt) + 1
+ * 			  bytes
+ *
+ * @return always true
+ */
+bool base64_encodeBuf(ubyte* in, uchar* out, size_t len_in, size_t* len_out, base64_opt_t opt)
 {
 	uchar *out_pos;
 	ubyte alphabet, *in_pos;
-	size_t remaining, len_out_l, len_line;
+	size_t remaining, len_out_l, len_line, done;
 	bool lineWrapping;
 
 	alphabet = (opt & base64_OPT_FILENAMESAFE) ? 1 : 0;
 	lineWrapping = (opt & base64_OPT_LINEWRAPPING);
 	
-	len_out_l = (ceil((float)len_in / 3 ) * 4);
-	if(lineWrapping) len_out_l += len_out_l / base64_LINE_LENGTH;
-	
-	out_pos = *out = (ubyte*)malloc(len_out_l + 1);
-	if (*out == NULL) return false;
+	len_out_l = base64_encodedLength(len_in, opt);
+	out_pos = out;
 	
 	in_pos = in;
 	remaining = len_in;
 	len_line = 0;
 	
+	//the kernel encodes the first bytes, the lines are wrapped only by the scalar code
+	if(alphabet == 1 && !lineWrapping){
+		done = base64_encodeKernel(in, len_in, out);
+		in_pos += done;
+		remaining -= done;
+		out_pos += done / 3 * 4;
+	}
+	
 	while (remaining >= 3){
 		/* Now we have 3 bytes, it will be divide in 4 group of 6 bits 
 		 * and with this 4 group we make 4 bytes filled with the base64_alphabets chars */
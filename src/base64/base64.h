@@ -18,7 +18,6 @@
 	
 	#include <stdlib.h>
 	#include <util.h> 
-	#include <math.h> 
  
 	/** Typedef of the variable that will contain the encoding and decoding options. */
 	typedef uchar base64_opt_t;
@@ -41,4 +40,25 @@
 	/** For encode a binary string to a readable string.  */
 	bool base64_encode(ubyte* in, uchar** out, size_t len_in, size_t* len_out, base64_opt_t opt);
 	
+	/** Like base64_decode but in a buffer of the caller. */
+	bool base64_decodeBuf(uchar* in, ubyte* out, size_t len_in, size_t* len_out, base64_opt_t opt);
+	
+	/** Like base64_encode but in a buffer of the caller. */
+	bool base64_encodeBuf(ubyte* in, uchar* out, size_t len_in, size_t* len_out, base64_opt_t opt);
+	
+	/** Length of the encoded string of len_in bytes, without the '\0' char */
+	size_t base64_encodedLength(size_t len_in, base64_opt_t opt);
+	
+	/** Max length of the decoded string of len_in chars */
+	#define base64_decodedMaxLength(len_in) ((len_in) / 4 * 3)
+	
+	/** Implementations of the filename safe alphabet, the best one is selected at startup */
+	#define base64_IMPL_SCALAR 0
+	#define base64_IMPL_SSE41 1
+	#define base64_IMPL_AVX2 2
+	#define base64_IMPL_AVX512VBMI 3
+	
+	/** For choose the implementation of the filename safe alphabet. */
+	int base64_useImpl(int impl);
+	
 #endif
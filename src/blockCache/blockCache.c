@@ -0,0 +1,287 @@
+/**
+ * @file blockCache.c
+ * @brief bounded and sharded LRU cache of decrypted file blocks
+*/
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+/*
+ * The cache contains only entire blocks (blockSize bytes) and the key is the backing file
+ * (device and inode number) plus the block number. The entries are distributed in
+ * BLOCKCACHE_SHARDS shards, every shard is an hash table with its own lock and its own LRU list,
+ * in this way the FUSE threads that read different blocks don't wait each other.
+ *
+ * <b>Generations</b>
+ * A reader that doesn't find a block in the cache reads it from the file and then put it in the
+ * cache, but in the meantime a writer can change the block. For this reason every shard has a
+ * generation that is incremented on every invalidation: the reader takes the generation before
+ * the read and blockCache_put discards the block if the generation is changed. The writers must
+ * invalidate the blocks after that the new data is written to the file.
+ */
+
+#include <blockCache.h>
+
+private inline ulong blockCache_hash(dev_t dev, ino_t ino, ulong block){
+	uint64_t h;
+
+	h = ((uint64_t)dev * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)ino * 0xC2B2AE3D27D4EB4FULL)
+		^ ((uint64_t)block * 0x165667B19E3779F9ULL);
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 32;
+
+	return (ulong)h;
+}
+
+private inline blockCacheShard_t* blockCache_shard(blockCache_t* c, ulong hash){
+	return &(c->shards[hash & (BLOCKCACHE_SHARDS - 1)]);
+}
+
+private inline blockCacheEntry_t** blockCache_bucket(blockCacheShard_t* s, ulong hash){
+	return &(s->buckets[(hash / BLOCKCACHE_SHARDS) % s->bucketCount]);
+}
+
+private inline void blockCache_lruUnlink(blockCacheEntry_t* e){
+	e->lruPrec->lruNext = e->lruNext;
+	e->lruNext->lruPrec = e->lruPrec;
+}
+
+private inline void blockCache_lruPushFront(blockCacheShard_t* s, blockCacheEntry_t* e){
+	e->lruNext = s->lru.lruNext;
+	e->lruPrec = &(s->lru);
+	s->lru.lruNext->lruPrec = e;
+	s->lru.lruNext = e;
+}
+
+/** Remove the entry from its hash chain, the shard lock must be held */
+private void blockCache_hashUnlink(blockCacheShard_t* s, blockCacheEntry_t* e){
+	blockCacheEntry_t** p;
+
+	p = blockCache_bucket(s, blockCache_hash(e->dev, e->ino, e->block));
+	while(*p != e) p = &((*p)->hashNext);
+	*p = e->hashNext;
+}
+
+/** Find an entry, the shard lock must be held */
+private blockCacheEntry_t* blockCache_find(blockCacheShard_t* s, ulong hash, dev_t dev, ino_t ino,
+										  ulong block){
+	blockCacheEntry_t* e;
+
+	for(e = *blockCache_bucket(s, hash); e != NULL; e = e->hashNext){
+		if(e->block == block && e->ino == ino && e->dev == dev) return e;
+	}
+
+	return NULL;
+}
+
+/** Create a new cache
+ *
+ * @param blockSize the size of every cached block
+ * @param capacity the maximum number of blocks that the cache can contain
+ *
+ * @return the cache, or NULL if there is not enough memory or the capacity is zero
+ */
+blockCache_t* blockCache_new(size_t blockSize, size_t capacity){
+	blockCache_t* c;
+	blockCacheShard_t* s;
+	int i;
+
+	if(capacity == 0) return NULL;
+
+	c = (blockCache_t*)malloc(sizeof(blockCache_t));
+	if(c == NULL) return NULL;
+	c->blockSize = blockSize;
+
+	for(i = 0; i < BLOCKCACHE_SHARDS; i++){
+		s = &(c->shards[i]);
+		s->capacity = (capacity + BLOCKCACHE_SHARDS - 1) / BLOCKCACHE_SHARDS;
+		s->bucketCount = s->capacity;
+		s->buckets = (blockCacheEntry_t**)calloc(s->bucketCount, sizeof(blockCacheEntry_t*));
+		if(s->buckets == NULL){
+			while(--i >= 0) free(c->shards[i].buckets);
+			free(c);
+			return NULL;
+		}
+		s->lru.lruNext = &(s->lru);
+		s->lru.lruPrec = &(s->lru);
+		s->count = 0;
+		s->generation = 0;
+		pthread_mutex_init(&(s->lock), NULL);
+	}
+
+	return c;
+}
+
+/** Dispose the cache and all its entries */
+void blockCache_dispose(blockCache_t* c){
+	blockCacheShard_t* s;
+	blockCacheEntry_t *e, *next;
+	int i;
+
+	if(c == NULL) return;
+
+	for(i = 0; i < BLOCKCACHE_SHARDS; i++){
+		s = &(c->shards[i]);
+		for(e = s->lru.lruNext; e != &(s->lru); e = next){
+			next = e->lruNext;
+			free(e);
+		}
+		free(s->buckets);
+		pthread_mutex_destroy(&(s->lock));
+	}
+
+	free(c);
+}
+
+/** Returns the current generation of the shard that contain a block, it must be taken before
+ * reading the block from the file and then given to blockCache_put
+ */
+ulong blockCache_generation(blockCache_t* c, dev_t dev, ino_t ino, ulong block){
+	blockCacheShard_t* s;
+	ulong generation;
+
+	s = blockCache_shard(c, blockCache_hash(dev, ino, block));
+	pthread_mutex_lock(&(s->lock));
+	generation = s->generation;
+	pthread_mutex_unlock(&(s->lock));
+
+	return generation;
+}
+
+/** Copy a cached block into buf
+ *
+ * @param buf the buffer that will contain the block, it must have a size of blockSize
+ * @param generation if the block is not in the cache it contains the generation of the shard, like
+ * blockCache_generation. It can be NULL
+ *
+ * @return true if the block was in the cache
+ */
+bool blockCache_get(blockCache_t* c, dev_t dev, ino_t ino, ulong block, ubyte* buf,
+					ulong* generation){
+	blockCacheShard_t* s;
+	blockCacheEntry_t* e;
+	ulong hash;
+
+	hash = blockCache_hash(dev, ino, block);
+	s = blockCache_shard(c, hash);
+
+	pthread_mutex_lock(&(s->lock));
+	e = blockCache_find(s, hash, dev, ino, block);
+	if(e == NULL){
+		if(generation != NULL) *generation = s->generation;
+		pthread_mutex_unlock(&(s->lock));
+		return false;
+	}
+	blockCache_lruUnlink(e);
+	blockCache_lruPushFront(s, e);
+	memcpy(buf, e->data, c->blockSize);
+	pthread_mutex_unlock(&(s->lock));
+
+	return true;
+}
+
+/** Put a decrypted block into the cache, if the cache is full the least recently used block of
+ * the shard is replaced
+ *
+ * @param buf the decrypted block, it must have a size of blockSize
+ * @param generation the generation returned by blockCache_generation before the block was read,
+ * if the shard was invalidated after that moment the block is discarded
+ */
+void blockCache_put(blockCache_t* c, dev_t dev, ino_t ino, ulong block, ubyte* buf,
+					ulong generation){
+	blockCacheShard_t* s;
+	blockCacheEntry_t** bucket;
+	blockCacheEntry_t* e;
+	ulong hash;
+
+	hash = blockCache_hash(dev, ino, block);
+	s = blockCache_shard(c, hash);
+
+	pthread_mutex_lock(&(s->lock));
+	if(s->generation != generation){
+		pthread_mutex_unlock(&(s->lock));
+		return;
+	}
+
+	e = blockCache_find(s, hash, dev, ino, block);
+	if(e != NULL){
+		blockCache_lruUnlink(e);
+	}else{
+		if(s->count >= s->capacity){
+			//reuse the least recently used entry
+			e = s->lru.lruPrec;
+			blockCache_lruUnlink(e);
+			blockCache_hashUnlink(s, e);
+		}else{
+			e = (blockCacheEntry_t*)malloc(sizeof(blockCacheEntry_t) + c->blockSize);
+			if(e == NULL){
+				pthread_mutex_unlock(&(s->lock));
+				return;
+			}
+			s->count++;
+		}
+		e->dev = dev;
+		e->ino = ino;
+		e->block = block;
+		bucket = blockCache_bucket(s, hash);
+		e->hashNext = *bucket;
+		*bucket = e;
+	}
+	memcpy(e->data, buf, c->blockSize);
+	blockCache_lruPushFront(s, e);
+	pthread_mutex_unlock(&(s->lock));
+}
+
+/** Remove a cached block, the shard lock must be held */
+private void blockCache_remove(blockCacheShard_t* s, blockCacheEntry_t* e){
+	blockCache_lruUnlink(e);
+	blockCache_hashUnlink(s, e);
+	free(e);
+	s->count--;
+}
+
+/** Invalidate the blocks of a file from first to last (included)
+ *
+ * @param last the last block to invalidate, BLOCKCACHE_LASTBLOCK for all the blocks after first
+ */
+void blockCache_invalidate(blockCache_t* c, dev_t dev, ino_t ino, ulong first, ulong last){
+	blockCacheShard_t* s;
+	blockCacheEntry_t *e, *next;
+	ulong block, hash;
+	int i;
+
+	if(last < first) return;
+
+	if(last - first < BLOCKCACHE_MAXLOOKUPS){
+		for(block = first; block <= last; block++){
+			hash = blockCache_hash(dev, ino, block);
+			s = blockCache_shard(c, hash);
+			pthread_mutex_lock(&(s->lock));
+			e = blockCache_find(s, hash, dev, ino, block);
+			if(e != NULL) blockCache_remove(s, e);
+			s->generation++;
+			pthread_mutex_unlock(&(s->lock));
+		}
+		return;
+	}
+
+	for(i = 0; i < BLOCKCACHE_SHARDS; i++){
+		s = &(c->shards[i]);
+		pthread_mutex_lock(&(s->lock));
+		for(e = s->lru.lruNext; e != &(s->lru); e = next){
+			next = e->lruNext;
+			if(e->ino == ino && e->dev == dev && e->block >= first && e->block <= last){
+				blockCache_remove(s, e);
+			}
+		}
+		s->generation++;
+		pthread_mutex_unlock(&(s->lock));
+	}
+}
@@ -0,0 +1,69 @@
+/**
+ * @file blockCache.h
+ * @brief bounded and sharded LRU cache of decrypted file blocks
+*/
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+#ifndef BLOCKCACHE_H
+
+	#define BLOCKCACHE_H
+
+	#include <stdlib.h>
+	#include <string.h>
+	#include <pthread.h>
+	#include <sys/types.h>
+	#include <util.h>
+
+	/** Number of shards, each shard has its own lock. It must be a power of two */
+	#define BLOCKCACHE_SHARDS 16
+
+	/** Maximum number of entries invalidated with single lookups, bigger ranges scan the shards */
+	#define BLOCKCACHE_MAXLOOKUPS 64
+
+	/** The last block of a file, used for invalidate all the blocks starting from a block */
+	#define BLOCKCACHE_LASTBLOCK ((ulong)-1)
+
+	typedef struct str_blockCacheEntry{
+		dev_t dev;
+		ino_t ino;
+		ulong block;
+		struct str_blockCacheEntry* hashNext;
+		struct str_blockCacheEntry* lruNext;
+		struct str_blockCacheEntry* lruPrec;
+		ubyte data[];
+	} blockCacheEntry_t;
+
+	typedef struct {
+		pthread_mutex_t lock;
+		blockCacheEntry_t** buckets;
+		size_t bucketCount;
+		blockCacheEntry_t lru; //sentinel, lru.lruNext is the most recently used entry
+		size_t count;
+		size_t capacity;
+		ulong generation;
+	} blockCacheShard_t;
+
+	typedef struct {
+		size_t blockSize;
+		blockCacheShard_t shards[BLOCKCACHE_SHARDS];
+	} blockCache_t;
+
+	blockCache_t* blockCache_new(size_t blockSize, size_t capacity);
+	void blockCache_dispose(blockCache_t* c);
+
+	ulong blockCache_generation(blockCache_t* c, dev_t dev, ino_t ino, ulong block);
+	bool blockCache_get(blockCache_t* c, dev_t dev, ino_t ino, ulong block, ubyte* buf,
+						ulong* generation);
+	void blockCache_put(blockCache_t* c, dev_t dev, ino_t ino, ulong block, ubyte* buf,
+						ulong generation);
+	void blockCache_invalidate(blockCache_t* c, dev_t dev, ino_t ino, ulong first, ulong last);
+
+#endif
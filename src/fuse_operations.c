@@ -8,472 +8,729 @@
  *
  */
 
+/*
+ * The operations use the low-level API of fuse: the kernel identifies the files with the nodeids
+ * returned by lookup, that are the addresses of the pubcfs_inode of the inode table (see
+ * pubcfs_inode.c). An operation on a name encrypts only that name and uses the *at calls on the
+ * descriptor of the parent, and the operations on an inode use its O_PATH descriptor or its
+ * /proc/self/fd path, so the full paths are never encoded.
+ */
+
 #include <fuse_operations.h>
 
-/** Get file attributes.
+/** Get the inode of a nodeid given by the kernel */
+private inline pubcfs_inode* pubcfs_getInode(pubcfs_context* ctx, fuse_ino_t ino){
+	if(ino == FUSE_ROOT_ID) return &(ctx->rootInode);
+	return (pubcfs_inode*)(uintptr_t)ino;
+}
+
+/** Get the nodeid of an inode */
+private inline fuse_ino_t pubcfs_getNodeid(pubcfs_context* ctx, pubcfs_inode* inode){
+	if(inode == &(ctx->rootInode)) return FUSE_ROOT_ID;
+	return (fuse_ino_t)(uintptr_t)inode;
+}
+
+/** Build the path that reopens the backing file of an inode, for the calls without an *at version
  *
- * Similar to stat().  The 'st_dev' and 'st_blksize' fields are
- * ignored.	 The 'st_ino' field is ignored except if the 'use_ino'
- * mount option is given.
+ * @param procPath a buffer of PUBCFS_PROCPATH_SIZE bytes
  */
-int pubcfs_getattr(const char *path, struct stat *statbuf){
-	int ris;
-	char* e_path;
-	pubcfs_context* ctx;
+private void pubcfs_getProcPath(pubcfs_inode* inode, char* procPath){
+	snprintf(procPath, PUBCFS_PROCPATH_SIZE, "/proc/self/fd/%d", inode->fd);
+}
+
+/** Look up a name created by an operation and reply with its entry, the lookup reference is
+ * released if the kernel doesn't receive it
+ *
+ * @param parent the inode of the folder
+ * @param e_name the name in the backing folder
+ */
+private void pubcfs_replyEntry(fuse_req_t req, pubcfs_context* ctx, pubcfs_inode* parent,
+							   const char* e_name){
+	struct fuse_entry_param e;
+	pubcfs_inode* inode;
+
+	memset(&e, 0, sizeof(e));
+	inode = pubcfs_lookupInode(ctx, parent, e_name, &(e.attr));
+	if(inode == NULL){
+		fuse_reply_err(req, errno);
+		return;
+	}
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	//the size must include the blocks not yet written
+	pubcfs_updateStat(ctx, &(e.attr));
+	e.ino = pubcfs_getNodeid(ctx, inode);
+	e.attr_timeout = ctx->attrTimeout;
+	e.entry_timeout = ctx->entryTimeout;
 
-	ris = lstat(e_path, statbuf);
-	free(e_path);
+	if(fuse_reply_entry(req, &e) != 0) pubcfs_forgetInode(ctx, inode, 1);
+}
 
-	if (ris != 0)
-		return -errno;
-	return 0;
+/** Remember the current state of the backing file of an inode changed through the kernel, the
+ * data in the kernel cache already contains the changes so the next open can keep it
+ */
+private void pubcfs_rememberInodeCache(pubcfs_context* ctx, pubcfs_inode* inode)
+{
+	struct stat st;
+
+	if(ctx->kernelCache == 0) return;
+	if(fstatat(inode->fd, "", &st, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW) == 0){
+		pubcfs_setInodeCache(ctx, inode, &st);
+	}
 }
 
-/** Read the target of a symbolic link
+/** Look up a directory entry by name and get its attributes
  *
- * The buffer should be filled with a null terminated string. The
- * buffer size argument includes the space for the terminating
- * null character.	If the linkname is too long to fit in the
- * buffer, it should be truncated.	The return value should be 0
- * for success.
+ * The returned entry takes a lookup reference that the kernel releases with forget.
  */
-int pubcfs_readlink(const char *path, char *link, size_t size)
+void pubcfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
-	int cris;
-	size_t buff_len, token_len;
-	char *e_path, *e_link, *strtok_ctx, *check, *buff, *ris, *token;
+	int ris;
+	char e_name[PUBCFS_NAME_SIZE];
 	pubcfs_context* ctx;
-	pubcfs_cryptoCtx* cctx;
 
-	ctx = pubcfs_getCtx();
-	cctx = pubcfs_getCryptoCtx(ctx);
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
-
-	e_link = malloc(size);
-	if(e_link == NULL){
-		free(e_path);
-		return -1;
-	}
-
-	cris = readlink(e_path, e_link, size - 1);
-	if (cris < 0) return -errno;
-	e_link[cris] = '\0';
-
-	ris = malloc(1);
-	ris[0] = '\0';
-	token = strtok_r(e_link, "/", &strtok_ctx);
-	while(token != NULL){
-		check = strstr(token, PUBCFS_FILENAME_ENC);
-		if(check == token){
-			ris = strappend(ris, PUBCFS_FILENAME_ENC_WITH_S);
-			token = token + PUBCFS_FILENAME_ENC_SIZE; //remove the PUBCFS_FILENAME_ENC prefix
-			token_len = strlen(token);
-			base64_decode((uchar*)token, (uchar**)(&buff), token_len, &buff_len, base64_OPT_FILENAMESAFE);
-			char* buff2 = malloc(buff_len);
-			if(buff2 == NULL){
-				free(ris);
-				return -1;
-			}
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	ris = pubcfs_encryptName(ctx, name, e_name, sizeof(e_name));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
-			pubcfs_decrypt(&(cctx->de), (uchar*)buff, (uchar*)buff2, buff_len);
-			buff2[buff_len] = '\0';
+	pubcfs_replyEntry(req, ctx, pubcfs_getInode(ctx, parent), e_name);
+}
 
-			ris = strappend(ris, buff2);
-			free(buff2);
-		}else{
-			ris = strappend(ris, "/");
-			ris = strappend(ris, token);
-		}
+/** Forget about an inode
+ *
+ * The nlookup parameter indicates the number of lookups previously performed on this inode.
+ * When the kernel forgets all of them the inode is removed from the table.
+ */
+void pubcfs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+	pubcfs_context* ctx;
 
-		token = strtok_r(NULL, "/", &strtok_ctx);
-	}
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	pubcfs_forgetInode(ctx, pubcfs_getInode(ctx, ino), nlookup);
+	fuse_reply_none(req);
+}
 
-	free(e_path);
-	strncpy(link, ris, size);
-	return 0;
+/** Forget about multiple inodes */
+void pubcfs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+	size_t i;
+	pubcfs_context* ctx;
+
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	for(i = 0; i < count; i++){
+		pubcfs_forgetInode(ctx, pubcfs_getInode(ctx, forgets[i].ino), forgets[i].nlookup);
+	}
+	fuse_reply_none(req);
 }
 
-/** Create a file node
+/** Get file attributes
  *
- * This is called for creation of all non-directory, non-symlink
- * nodes.  If the filesystem defines a create() method, then for
- * regular files that will be called instead.
+ * If the file is open fi contains its handle, otherwise it is NULL. With writeback_cache the
+ * kernel ignores size and mtime while it has pages not yet written, they are sent with the
+ * writes and setattr.
  */
-int pubcfs_mknod(const char *path, mode_t mode, dev_t dev)
+void pubcfs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	int ris;
-	char* e_path;
+	struct stat st;
+	pubcfs_fileHandle* fh;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
 
-	/* this is not portable because in other SO mknod is used only for create mkfifo and if
-	 * mode != S_IFIFO the behavior is unspecified */
-	ris = mknod(e_path, mode, dev);
-	free(e_path);
-	if (ris < 0) return -errno;
+	if(fi != NULL){
+		fh = (pubcfs_fileHandle*)(ulong)(fi->fh);
+		ris = fstat(fh->fd, &st);
+	}else{
+		ris = fstatat(pubcfs_getInode(ctx, ino)->fd, "", &st, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+	}
+	if(ris != 0){
+		fuse_reply_err(req, errno);
+		return;
+	}
+
+	//the size must include the blocks not yet written
+	pubcfs_updateStat(ctx, &st);
+
+	fuse_reply_attr(req, &st, ctx->attrTimeout);
+}
+
+/** Change the size of a backing file with pubcfs_setFileSize
+ *
+ * @param fh the handle used by ftruncate, or NULL
+ * @param procPath the path of the inode, see pubcfs_getProcPath
+ *
+ * @return 0 or -errno, -EACCES if the file can't be read and its last block must be encrypted again
+ */
+private int pubcfs_truncateBacking(pubcfs_context* ctx, pubcfs_fileHandle* fh, const char* procPath,
+								   off_t newSize)
+{
+	int fd, ris;
+	bool safe;
+	struct stat st;
+
+	if(fh != NULL) return pubcfs_setFileSize(ctx, pubcfs_getCryptoCtx(ctx), fh->fd, newSize);
+
+	fd = open(procPath, O_RDWR);
+	if(fd < 0){
+		/* a file that can't be read is truncated only if no block must be decrypted: a shrink
+		 * of cfb8 keeps a prefix of the new last block, a shrink of xts must end on a block
+		 * boundary and a file can grow only by whole blocks after a whole last block */
+		if(stat(procPath, &st) < 0) return -errno;
+		if(newSize < st.st_size){
+			safe = ctx->cipher != PUBCFS_CIPHER_XTS || newSize % ctx->blockSize == 0;
+		}else{
+			safe = newSize == st.st_size
+				|| (newSize % ctx->blockSize == 0 && st.st_size % ctx->blockSize == 0);
+		}
+		if(!safe) return -EACCES;
+		return (truncate(procPath, newSize) < 0) ? -errno : 0;
+	}
+	ris = pubcfs_setFileSize(ctx, pubcfs_getCryptoCtx(ctx), fd, newSize);
+	close(fd);
 
 	return ris;
 }
 
-/** Create a directory
+/** Change the size of a file, if it is open its dirty blocks are written before
  *
- * Note that the mode argument may not have the type specification
- * bits set, i.e. S_ISDIR(mode) can be false.  To obtain the
- * correct directory type bits use  mode|S_IFDIR
- * */
-int pubcfs_mkdir(const char *path, mode_t mode)
+ * @param fh the handle used by ftruncate, or NULL
+ * @param procPath the path of the inode, see pubcfs_getProcPath
+ *
+ * @return 0 or -errno
+ */
+private int pubcfs_truncateInode(pubcfs_context* ctx, pubcfs_inode* inode, pubcfs_fileHandle* fh,
+								 const char* procPath, off_t newSize)
 {
 	int ris;
-	char* e_path;
-	pubcfs_context* ctx;
-
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	pubcfs_openFile* of;
+
+	of = pubcfs_getOpenFile(ctx, inode->dev, inode->ino, 0, false);
+	if(of != NULL){
+		pthread_mutex_lock(&(of->lock));
+		ris = pubcfs_writeBackLocked(ctx, pubcfs_getCryptoCtx(ctx), of);
+		if(ris == 0){
+			ris = pubcfs_truncateBacking(ctx, fh, procPath, newSize);
+			if(ris == 0) of->size = newSize;
+		}
+		pthread_mutex_unlock(&(of->lock));
+		pubcfs_putOpenFile(ctx, of);
+	}else{
+		ris = pubcfs_truncateBacking(ctx, fh, procPath, newSize);
+	}
+	if (ris < 0) return ris;
 
-	ris = mkdir(e_path, mode);
-	free(e_path);
-	if (ris < 0) return -errno;
+	//the block that contain newSize and all the next blocks are changed
+	pubcfs_invalidateBlocks(ctx, inode->dev, inode->ino, newSize / ctx->blockSize,
+							BLOCKCACHE_LASTBLOCK);
 
-	return ris;
+	return 0;
 }
 
-/** Remove a file */
-int pubcfs_unlink(const char *path)
+/** Set file attributes
+ *
+ * In the 'attr' argument only members indicated by the 'to_set' bitmask contain valid values.
+ * Other members contain undefined values. This replaces chmod, chown, truncate and utime of the
+ * path operations. If the request comes from an ftruncate or a futimens fi contains the handle.
+ */
+void pubcfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+		struct fuse_file_info *fi)
 {
 	int ris;
-	char* e_path;
+	char procPath[PUBCFS_PROCPATH_SIZE];
+	uid_t uid;
+	gid_t gid;
+	struct timespec times[2];
+	pubcfs_inode* inode;
+	pubcfs_openFile* of;
+	pubcfs_fileHandle* fh;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	inode = pubcfs_getInode(ctx, ino);
+	fh = (fi != NULL) ? (pubcfs_fileHandle*)(ulong)(fi->fh) : NULL;
+	pubcfs_getProcPath(inode, procPath);
+
+	if(to_set & FUSE_SET_ATTR_MODE){
+		ris = (fh != NULL) ? fchmod(fh->fd, attr->st_mode) : chmod(procPath, attr->st_mode);
+		if(ris < 0) goto err;
+	}
 
-	ris = unlink(e_path);
-	free(e_path);
-	if (ris < 0) return -errno;
+	if(to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)){
+		uid = (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1;
+		gid = (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1;
+		/*I use AT_SYMLINK_NOFOLLOW because if the inode is a link it will work too*/
+		ris = fchownat(inode->fd, "", uid, gid, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+		if(ris < 0) goto err;
+	}
 
-	return ris;
+	if(to_set & FUSE_SET_ATTR_SIZE){
+		ris = pubcfs_truncateInode(ctx, inode, fh, procPath, attr->st_size);
+		if(ris < 0){
+			fuse_reply_err(req, -ris);
+			return;
+		}
+	}
+
+	if(to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)){
+		/* the dirty blocks are written before, otherwise their write-back would change the mtime
+		 * again. With writeback_cache this is the mtime of the last write given by the kernel */
+		of = pubcfs_getOpenFile(ctx, inode->dev, inode->ino, 0, false);
+		if(of != NULL){
+			ris = pubcfs_writeBack(ctx, pubcfs_getCryptoCtx(ctx), of);
+			pubcfs_putOpenFile(ctx, of);
+			if(ris < 0){
+				fuse_reply_err(req, -ris);
+				return;
+			}
+		}
+
+		times[0].tv_sec = 0;
+		times[0].tv_nsec = UTIME_OMIT;
+		times[1].tv_sec = 0;
+		times[1].tv_nsec = UTIME_OMIT;
+		if(to_set & FUSE_SET_ATTR_ATIME_NOW) times[0].tv_nsec = UTIME_NOW;
+		else if(to_set & FUSE_SET_ATTR_ATIME) times[0] = attr->st_atim;
+		if(to_set & FUSE_SET_ATTR_MTIME_NOW) times[1].tv_nsec = UTIME_NOW;
+		else if(to_set & FUSE_SET_ATTR_MTIME) times[1] = attr->st_mtim;
+
+		ris = (fh != NULL) ? futimens(fh->fd, times) : utimensat(AT_FDCWD, procPath, times, 0);
+		if(ris < 0) goto err;
+	}
+
+	//the kernel changed its cache in the same way
+	if(to_set & (FUSE_SET_ATTR_SIZE | FUSE_SET_ATTR_MTIME)) pubcfs_rememberInodeCache(ctx, inode);
+
+	pubcfs_getattr(req, ino, fi);
+	return;
+
+	//Errors
+	err:
+		fuse_reply_err(req, errno);
 }
 
-/** Remove a directory */
-int pubcfs_rmdir(const char *path)
+/** Read the target of a symbolic link */
+void pubcfs_readlink(fuse_req_t req, fuse_ino_t ino)
 {
 	int ris;
-	char* e_path;
+	char e_link[PATH_MAX], link[PATH_MAX];
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
 
-	ris = rmdir(e_path);
-	free(e_path);
-	if (ris < 0) return -errno;
+	ris = readlinkat(pubcfs_getInode(ctx, ino)->fd, "", e_link, PATH_MAX - 1);
+	if (ris < 0){
+		fuse_reply_err(req, errno);
+		return;
+	}
+	e_link[ris] = '\0';
 
-	return ris;
+	ris = pubcfs_decodePath(ctx, e_link, link);
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
+
+	fuse_reply_readlink(req, link);
 }
 
-/** Create a symbolic link */
-int pubcfs_symlink(const char *path1, const char *path2)
+/** Create a file node
+ *
+ * This is called for creation of all non-directory, non-symlink
+ * nodes.  If the filesystem defines a create() method, then for
+ * regular files that will be called instead.
+ */
+void pubcfs_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
 {
 	int ris;
-	char *e_path1, *e_path2;
+	char e_name[PUBCFS_NAME_SIZE];
+	struct stat st;
+	pubcfs_inode* p;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-
-	e_path1 = pubcfs_encodePath(ctx, path1, false);
-	if(e_path1 == NULL) return -errno;
-	e_path2 = pubcfs_encodePath(ctx, path2, true);
-	if(e_path2 == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	p = pubcfs_getInode(ctx, parent);
+	ris = pubcfs_encryptName(ctx, name, e_name, sizeof(e_name));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
-	ris = symlink(e_path1, e_path2);
-	free(e_path2);
-	free(e_path1);
-	if(ris < 0) return -errno;
+	/* this is not portable because in other SO mknod is used only for create mkfifo and if
+	 * mode != S_IFIFO the behavior is unspecified */
+	ris = mknodat(p->fd, e_name, mode, rdev);
+	if (ris < 0){
+		fuse_reply_err(req, errno);
+		return;
+	}
 
-	return 0;
+	//a new file can have the inode number of a removed file
+	if(fstatat(p->fd, e_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode)){
+		pubcfs_invalidateBlocks(ctx, st.st_dev, st.st_ino, 0, BLOCKCACHE_LASTBLOCK);
+	}
+	pubcfs_replyEntry(req, ctx, p, e_name);
 }
 
-/** Rename a file */
-int pubcfs_rename(const char *old, const char *new)
+/** Create a directory
+ *
+ * Note that the mode argument may not have the type specification
+ * bits set, i.e. S_ISDIR(mode) can be false.  To obtain the
+ * correct directory type bits use  mode|S_IFDIR
+ * */
+void pubcfs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 {
 	int ris;
-	char *e_old, *e_new;
+	char e_name[PUBCFS_NAME_SIZE];
+	pubcfs_inode* p;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_old = pubcfs_encodePath(ctx, old, true);
-	if(e_old == NULL) return -errno;
-	e_new = pubcfs_encodePath(ctx, new, true);
-	if(e_new == NULL) return -errno;
-	ris = rename(e_old, e_new);
-	free(e_old);
-	free(e_new);
-	if(ris < 0) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	p = pubcfs_getInode(ctx, parent);
+	ris = pubcfs_encryptName(ctx, name, e_name, sizeof(e_name));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
-	return 0;
+	ris = mkdirat(p->fd, e_name, mode);
+	if (ris < 0) fuse_reply_err(req, errno);
+	else pubcfs_replyEntry(req, ctx, p, e_name);
 }
 
-/** Create a hard link to a file */
-int pubcfs_link(const char *path1, const char *path2)
+/** Remove a file */
+void pubcfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	int ris;
-	char *e_path1, *e_path2;
+	char e_name[PUBCFS_NAME_SIZE];
+	struct stat st;
+	bool cached;
+	pubcfs_inode* p;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path1 = pubcfs_encodePath(ctx, path1, true);
-	if(e_path1 == NULL) return -errno;
-	e_path2 = pubcfs_encodePath(ctx, path2, true);
-	if(e_path2 == NULL) return -errno;
-	ris = link(e_path1, e_path2);
-	free(e_path2);
-	free(e_path1);
-	if(ris < 0) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	p = pubcfs_getInode(ctx, parent);
+	ris = pubcfs_encryptName(ctx, name, e_name, sizeof(e_name));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
-	return 0;
+	//we need the inode for remove the cached blocks of the file
+	cached = (fstatat(p->fd, e_name, &st, AT_SYMLINK_NOFOLLOW) == 0) && S_ISREG(st.st_mode);
+
+	ris = unlinkat(p->fd, e_name, 0);
+	if (ris < 0){
+		fuse_reply_err(req, errno);
+		return;
+	}
+
+	if(cached) pubcfs_invalidateBlocks(ctx, st.st_dev, st.st_ino, 0, BLOCKCACHE_LASTBLOCK);
+
+	fuse_reply_err(req, 0);
 }
 
-/** Change the permission bits of a file */
-int pubcfs_chmod(const char *path, mode_t mode)
+/** Remove a directory */
+void pubcfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	int ris;
-	char* e_path;
+	char e_name[PUBCFS_NAME_SIZE];
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	ris = pubcfs_encryptName(ctx, name, e_name, sizeof(e_name));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
-	ris = chmod(e_path, mode);
-	free(e_path);
-	if (ris < 0) return -errno;
+	ris = unlinkat(pubcfs_getInode(ctx, parent)->fd, e_name, AT_REMOVEDIR);
 
-	return ris;
+	fuse_reply_err(req, (ris < 0) ? errno : 0);
 }
 
-/** Change the owner and group of a file */
-int pubcfs_chown(const char *path, uid_t uid, gid_t gid)
+/** Create a symbolic link */
+void pubcfs_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
 {
 	int ris;
-	char* e_path;
+	char e_link[PATH_MAX], e_name[PUBCFS_NAME_SIZE];
+	pubcfs_inode* p;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	p = pubcfs_getInode(ctx, parent);
 
-	/*I use the lchown because if path is a link it will work too*/
-	ris = lchown(e_path, uid, gid);
-	free(e_path);
-	if (ris < 0) return -errno;
+	ris = pubcfs_encodePath(ctx, link, e_link);
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
+	ris = pubcfs_encryptName(ctx, name, e_name, sizeof(e_name));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
-	return ris;
+	ris = symlinkat(e_link, p->fd, e_name);
+	if(ris < 0) fuse_reply_err(req, errno);
+	else pubcfs_replyEntry(req, ctx, p, e_name);
 }
 
-/** Change the size of a file */
-int pubcfs_truncate(const char *path, off_t newSize)
+/** Rename a file
+ *
+ * The flags of renameat2 (RENAME_EXCHANGE and RENAME_NOREPLACE) are not supported.
+ */
+void pubcfs_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent,
+		const char *newname, unsigned int flags)
 {
 	int ris;
-	char* e_path;
+	char e_old[PUBCFS_NAME_SIZE], e_new[PUBCFS_NAME_SIZE];
+	struct stat st;
+	bool cached;
+	pubcfs_inode *p, *newp;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
-	ris = truncate(e_path, newSize);
-	free(e_path);
-	if (ris < 0) return -errno;
+	if(flags != 0){
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
 
-	return ris;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	p = pubcfs_getInode(ctx, parent);
+	newp = pubcfs_getInode(ctx, newparent);
+	ris = pubcfs_encryptName(ctx, name, e_old, sizeof(e_old));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
+	ris = pubcfs_encryptName(ctx, newname, e_new, sizeof(e_new));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
+
+	//if the new file exists it will be replaced, so its cached blocks must be removed
+	cached = (fstatat(newp->fd, e_new, &st, AT_SYMLINK_NOFOLLOW) == 0) && S_ISREG(st.st_mode);
+
+	ris = renameat(p->fd, e_old, newp->fd, e_new);
+	if(ris < 0){
+		fuse_reply_err(req, errno);
+		return;
+	}
+
+	if(cached) pubcfs_invalidateBlocks(ctx, st.st_dev, st.st_ino, 0, BLOCKCACHE_LASTBLOCK);
+
+	fuse_reply_err(req, 0);
 }
 
-/** Change the access and/or modification times of a file */
-int pubcfs_utime(const char *path, struct utimbuf *times)
+/** Create a hard link to a file */
+void pubcfs_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname)
 {
 	int ris;
-	char* e_path;
+	char procPath[PUBCFS_PROCPATH_SIZE];
+	char e_name[PUBCFS_NAME_SIZE];
+	pubcfs_inode* newp;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
-
-	ris = utime(e_path, times);
-	free(e_path);
-	if (ris < 0) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	newp = pubcfs_getInode(ctx, newparent);
+	pubcfs_getProcPath(pubcfs_getInode(ctx, ino), procPath);
+	ris = pubcfs_encryptName(ctx, newname, e_name, sizeof(e_name));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
-	return ris;
+	//linkat with AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, the /proc path doesn't
+	ris = linkat(AT_FDCWD, procPath, newp->fd, e_name, AT_SYMLINK_FOLLOW);
+	if(ris < 0) fuse_reply_err(req, errno);
+	else pubcfs_replyEntry(req, ctx, newp, e_name);
 }
 
-/** File open operation
+/** Open a backing file
  *
- * No creation (O_CREAT, O_EXCL) and by default also no
- * truncation (O_TRUNC) flags will be passed to open(). If an
- * application specifies O_TRUNC, fuse first calls truncate()
- * and then open(). Only if 'atomic_o_trunc' has been
- * specified and kernel version is 2.6.24 or later, O_TRUNC is
- * passed on to open.
+ * The writes of a block need to read the rest of the block, so a write only file is opened for
+ * reading too (if the permissions allow it), and with writeback_cache the kernel reads the pages
+ * that are partially written with the same handle. O_APPEND is removed because the blocks are
+ * written with pwrite at their offsets, the offset of the appending writes is already the end of
+ * the file (computed by the kernel with writeback_cache).
  *
- * Unless the 'default_permissions' mount option is given,
- * open should check if the operation is permitted for the
- * given flags. Optionally open may also return an arbitrary
- * filehandle in the fuse_file_info structure, which will be
- * passed to all file operations.
+ * @param dirfd the folder of e_name, or AT_FDCWD
  *
- * Changed in version 2.2
+ * @return the file descriptor or -1 (errno is set)
  */
-int pubcfs_open(const char *path, struct fuse_file_info *fi)
+private int pubcfs_openBackingFile(int dirfd, const char* e_name, int flags, mode_t mode)
 {
 	int fd;
-	char* e_path;
-	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	flags &= ~O_APPEND;
+	if((flags & O_ACCMODE) == O_WRONLY){
+		fd = openat(dirfd, e_name, (flags & ~O_ACCMODE) | O_RDWR, mode);
+		if(fd >= 0 || errno != EACCES) return fd;
+	}
 
-	fd = open(e_path, fi->flags);
-	free(e_path);
-	if (fd < 0) return -errno;
-	fi->fh = fd;
+	return openat(dirfd, e_name, flags, mode);
+}
 
-	return 0;
+/** Tell the kernel to keep the cached data of a file that is opened if the backing file is not
+ * changed since the last open, otherwise the kernel removes it
+ *
+ * @param fd the descriptor of the opened backing file
+ */
+private void pubcfs_setKeepCache(pubcfs_context* ctx, pubcfs_inode* inode, int fd,
+								 struct fuse_file_info *fi)
+{
+	struct stat st;
+
+	if(ctx->kernelCache == 0 || fstat(fd, &st) != 0) return;
+	fi->keep_cache = pubcfs_checkInodeCache(ctx, inode, &st);
 }
 
-/** Read data from an open file
+/** Open a file
  *
- * Read should return exactly the number of bytes requested except
- * on EOF or error, otherwise the rest of the data will be
- * substituted with zeroes.	 An exception to this is when the
- * 'direct_io' mount option is specified, in which case the return
- * value of the read system call will reflect the return value of
- * this operation.
+ * Open flags are available in fi->flags. Creation (O_CREAT, O_EXCL, O_NOCTTY) flags will be
+ * filtered out, and O_TRUNC is not passed because pubcfs_init disables atomic_o_trunc: the kernel
+ * truncates the file with setattr before, so the dirty and the cached blocks are removed.
  *
- * Changed in version 2.2
+ * The handle of the file is saved in fi->fh and it is passed to all file operations.
  */
-int pubcfs_read(const char *path, char *buf, size_t count, off_t offset, struct fuse_file_info *fi)
+void pubcfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	int ris;
-	ulong block; //current block where we start to read
-	size_t blockSize;
-    off_t blockOffset; //offset relative to the start of the current block
-    size_t blockRemainingSpace; //space to read until reach the end of the block or 'size'
-    off_t endOffset;
-    size_t writed, toCopy;
-    ubyte* blockBuf;
-    pubcfs_context* ctx;
-    pubcfs_cryptoCtx* cctx;
-
-    ctx = pubcfs_getCtx();
-    cctx = pubcfs_getCryptoCtx(ctx);
-    blockSize = ctx->blockSize;
-    blockBuf = (ubyte*)malloc(blockSize);
-    if(blockBuf == NULL) return -1;
-    endOffset = offset + count;
-    writed = 0;
-
-    /* First of all with the 'offset' param it calculate the first block. Then the loop start
-     * and finish when the current block contain the 'offset' + 'count' byte. For example if the
-     * count is a little less then blockSize*2 the loop do two iterations for read the first and
-     * the second block starting from the block that contain the 'offset' byte.
-     *
-     * numeric example
-	 *
-	 *	|----------|--^-------|-----------|... (blocksize=10; offset=12; count=12)
-	 *	block=12/10=1; and with this we calculate that the first block is the second
-	 *	then the loop continue with the third and then it finish because 30 >= 12+12
-	 */
+	int fd, err;
+	char procPath[PUBCFS_PROCPATH_SIZE];
+	pubcfs_inode* inode;
+	pubcfs_fileHandle* fh;
+	pubcfs_context* ctx;
 
-    block = offset / blockSize;
-    while((block * blockSize) < endOffset){
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	inode = pubcfs_getInode(ctx, ino);
+	pubcfs_getProcPath(inode, procPath);
 
-		if (block * blockSize < offset){ //check that the start of the block is before the offset
-			blockOffset = offset % blockSize;
-		}else{
-			/* in this case the offset is before the start of the current block and we need to
-			 * read all the block starting from the first possition. */
-			blockOffset = 0;
-		}
+	//the /proc path is a link to the backing file, so it must be followed
+	fd = pubcfs_openBackingFile(AT_FDCWD, procPath, fi->flags & ~O_NOFOLLOW, 0);
+	if (fd < 0){
+		fuse_reply_err(req, errno);
+		return;
+	}
 
-		if (((block + 1) * blockSize) <= endOffset){
-			/* in this case we need to read all the remaining space of the block because endOffset
-			 * is after the end of the current block */
-			blockRemainingSpace = blockSize - blockOffset;
-		}else{
-			/* in this case we need to read until endOffset
-			 * (endOffset % blockSize) is the offset of endOffset relative to the start of the block
-			 * like the blockOffset
-			 */
-			blockRemainingSpace = (endOffset % blockSize) - blockOffset;
-		}
+	fh = pubcfs_createFileHandle(ctx, fd);
+	if(fh == NULL){
+		err = errno;
+		close(fd);
+		fuse_reply_err(req, err);
+		return;
+	}
+	fi->fh = (ulong)fh;
+	pubcfs_setKeepCache(ctx, inode, fd, fi);
 
-		//read the block and copy it into blockBuf
-		ris = pubcfs_readBlock(ctx, cctx, fi->fh, block, blockBuf);
-		if(ris == -1){ //error
-			free(blockBuf);
-			return -1;
-		}if(ris <= blockOffset){ //it's like it don't read anything
-			break;
-		}
+	//if the request was interrupted there will be no release
+	if(fuse_reply_open(req, fi) != 0){
+		close(fd);
+		pubcfs_destroyFileHandle(ctx, fh);
+	}
+}
 
-		toCopy = ris - blockOffset;
-		//we read the entire block but we need only a part
-		memcpy(buf + writed, blockBuf + blockOffset, toCopy);
-		writed += toCopy;
+/** Read data from an open file
+ *
+ * Read should send exactly the number of bytes requested except on EOF or error, otherwise the
+ * rest of the data will be substituted with zeroes.
+ *
+ * The blocks are decrypted directly in the buffer of the reply, so when the read starts at the
+ * start of a block (always for the reads of the kernel with a block size multiple of the page)
+ * the data is never copied. With splice_write the buffer is given to the kernel with vmsplice.
+ */
+void pubcfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		struct fuse_file_info *fi)
+{
+	int ris;
+	ubyte* data;
+	struct fuse_bufvec bufv;
+	pubcfs_fileHandle* fh;
+	pubcfs_context* ctx;
+	pubcfs_cryptoCtx* cctx;
 
-		/* if readBlock read a number of bytes smaller than blockOffset + blockRemainingSpace it
-		 * means that the read don't have other to read */
-		if(ris < blockOffset + blockRemainingSpace) break;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	cctx = pubcfs_getCryptoCtx(ctx);
+	fh = (pubcfs_fileHandle*)(ulong)(fi->fh);
 
-		block++;
-    }
+	//if the reads are sequential the next blocks are read in background
+	pubcfs_readAhead(ctx, fh, off, size);
 
-    free(blockBuf);
-    return writed;
+	/* the blocks that contain the requested bytes are read with a single pread and decrypted, then
+	 * the requested part is sent from the buffer of the blocks.
+	 *
+	 * numeric example
+	 *
+	 *	|----------|--^-------|-----------|... (blocksize=10; offset=12; count=12)
+	 *	the blocks 1 and 2 are read (from 10 to 30) and the bytes from 12 to 24 are sent
+	 */
+	ris = pubcfs_readFileBuf(ctx, cctx, fh, &data, size, off);
+	if(ris < 0){
+		fuse_reply_err(req, errno);
+		return;
+	}
 
+	bufv = FUSE_BUFVEC_INIT(ris);
+	bufv.buf[0].mem = data;
+	fuse_reply_data(req, &bufv, FUSE_BUF_SPLICE_MOVE);
+	free(data);
 }
 
-/** Write data to an open file
+/** Write the data of a fuse_bufvec to an open file
  *
- * Write should return exactly the number of bytes requested
- * except on error.	 An exception to this is when the 'direct_io'
- * mount option is specified (see read operation).
+ * The data is copied with fuse_buf_copy directly in the dirty blocks, that are encrypted later.
+ * If the source is a pipe (splice_read) the data is read from the pipe into the blocks.
  *
- * Changed in version 2.2
+ * @param src the data, it is advanced by the copied bytes
+ * @param count the bytes of src
+ *
+ * @return the written bytes or -errno
  */
-int pubcfs_write(const char *path, const char *buf, size_t count, off_t offset,
-		struct fuse_file_info *fi)
+private int pubcfs_writeData(pubcfs_context* ctx, pubcfs_fileHandle* fh, struct fuse_bufvec *src,
+		size_t count, off_t offset)
 {
 	int ris;
+	ssize_t copied;
+	struct fuse_bufvec dst;
 	ulong block; //current block where we start to read
 	size_t blockSize;
 	off_t blockOffset; //offset relative to the start of the current block
 	size_t blockRemainingSpace; //space to read until reach the end of the block or 'size'
 	off_t endOffset;
 	size_t writed;
-	ubyte* blockBuf;
-	pubcfs_context* ctx;
+	pubcfs_dirtyBlock* db;
+	pubcfs_openFile* of;
 	pubcfs_cryptoCtx* cctx;
 
-	ctx = pubcfs_getCtx();
 	cctx = pubcfs_getCryptoCtx(ctx);
+	of = fh->of;
 	blockSize = ctx->blockSize;
-	blockBuf = (ubyte*)malloc(blockSize);
-	if(blockBuf == NULL) return -1;
 	endOffset = offset + count;
 	writed = 0;
 
+	/* The blocks are changed in memory (see pubcfs_file.c) and they are encrypted and written
+	 * later, so the next writes to the same blocks don't need to read and encrypt them again */
+	pthread_mutex_lock(&(of->lock));
+
+	/* if the write starts after the end of the file the last block, that can be partial, is
+	 * filled with zeros until the end or the write offset */
+	if(offset > of->size && of->size % blockSize != 0){
+		block = of->size / blockSize;
+		db = pubcfs_getDirtyBlock(ctx, cctx, fh, block, true);
+		if(db == NULL){
+			ris = -errno;
+			pthread_mutex_unlock(&(of->lock));
+			return ris;
+		}
+		blockOffset = (offset < (block + 1) * blockSize) ? offset % blockSize : blockSize;
+		if(db->size < blockOffset){
+			pubcfs_markChanged(db, db->size);
+			memset(db->data + db->size, 0, blockOffset - db->size);
+			db->size = blockOffset;
+		}
+	}
+
 	block = offset / blockSize;
 	while((block * blockSize) < endOffset){
 
@@ -497,57 +754,85 @@ int pubcfs_write(const char *path, const char *buf, size_t count, off_t offset,
 			blockRemainingSpace = (endOffset % blockSize) - blockOffset;
 		}
 
-		//We need to read the block and change it, then we need to rewrite into the file
-
-		//check if we need to read a block
-		if((blockOffset != 0) && (blockRemainingSpace != blockSize)){
-			//read the block and copy it into blockBuf
-			ris = pubcfs_readBlock(ctx, cctx, fi->fh, block, blockBuf);
-			if(ris == -1){
-				free(blockBuf);
-				return -1;
-			}
+		/* get the dirty block, its current content is read only if the write doesn't cover all
+		 * the block. Every encrypted byte depends on the previous ones, so the old bytes after
+		 * the written part will be encrypted and written again, but with cfb8 the bytes before
+		 * it are not (see pubcfs_markChanged) */
+		db = pubcfs_getDirtyBlock(ctx, cctx, fh, block, blockRemainingSpace != blockSize);
+		if(db == NULL){
+			ris = -errno;
+			pthread_mutex_unlock(&(of->lock));
+			return ris;
 		}
 
-		//change and write the block
-		memcpy(blockBuf + blockOffset, buf + writed, blockRemainingSpace);
-		if(pubcfs_writeBlock(ctx, cctx, fi->fh, block, blockBuf,
-							 blockOffset + blockRemainingSpace) == -1){
-			free(blockBuf);
-			return -1;
+		//the space between the end of the block and the write contains zeros
+		pubcfs_markChanged(db, (db->size < blockOffset) ? db->size : blockOffset);
+		if(db->size < blockOffset) memset(db->data + db->size, 0, blockOffset - db->size);
+		dst = FUSE_BUFVEC_INIT(blockRemainingSpace);
+		dst.buf[0].mem = db->data + blockOffset;
+		copied = fuse_buf_copy(&dst, src, 0);
+		if(copied < 0){
+			if(db->size < blockOffset) db->size = blockOffset;
+			pthread_mutex_unlock(&(of->lock));
+			return copied;
+		}
+		if(db->size < blockOffset + copied){
+			db->size = blockOffset + copied;
 		}
 
-		writed += blockRemainingSpace;
+		writed += copied;
+		if((size_t)copied < blockRemainingSpace) break; //the source ended before count
 
 		block++;
 	}
 
-	free(blockBuf);
+	if(offset + (off_t)writed > of->size) of->size = offset + writed;
+
+	//without a dirty limit the file is written immediately
+	ris = 0;
+	if(ctx->dirtyLimit == 0 || pubcfs_dirtyLimitReached(ctx)){
+		ris = pubcfs_writeBackLocked(ctx, cctx, of);
+	}
+	pthread_mutex_unlock(&(of->lock));
+	if(ris < 0) return ris;
+
 	return writed;
 }
 
-/** Get file system statistics
+/** Write data made available in a buffer vector
  *
- * The 'f_frsize', 'f_favail', 'f_fsid' and 'f_flag' fields are ignored
- *
- * Replaced 'struct statfs' parameter with 'struct statvfs' in
- * version 2.5
+ * The data can be in a pipe when splice_read is enabled, in this case it is read from the pipe
+ * directly into the blocks without a copy in a fuse buffer.
  */
-int pubcfs_statfs(const char *path, struct statvfs *statv)
+void pubcfs_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off,
+		struct fuse_file_info *fi)
 {
 	int ris;
-	char* e_path;
+	pubcfs_fileHandle* fh;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	fh = (pubcfs_fileHandle*)(ulong)(fi->fh);
 
-	ris = statvfs(e_path, statv);
-	free(e_path);
-	if(ris < 0) return -errno;
+	ris = pubcfs_writeData(ctx, fh, bufv, fuse_buf_size(bufv), off);
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
+	fh->written = true;
+	fuse_reply_write(req, ris);
+}
 
-	return 0;
+/** Get file system statistics */
+void pubcfs_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	struct statvfs statv;
+	pubcfs_context* ctx;
+
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+
+	if(fstatvfs(pubcfs_getInode(ctx, ino)->fd, &statv) < 0) fuse_reply_err(req, errno);
+	else fuse_reply_statfs(req, &statv);
 }
 
 /** Possibly flush cached data
@@ -567,15 +852,16 @@ int pubcfs_statfs(const char *path, struct statvfs *statv)
  * not possible to determine if a flush is final, so each flush
  * should be treated equally.  Multiple write-flush sequences are
  * relatively rare, so this shouldn't be a problem.
- *
- * Filesystems shouldn't assume that flush will always be called
- * after some writes, or that if will be called at all.
- *
- * Changed in version 2.2
  */
-int pubcfs_flush(const char *path, struct fuse_file_info *fi)
+void pubcfs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	return 0;
+	pubcfs_fileHandle* fh;
+	pubcfs_context* ctx;
+
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	fh = (pubcfs_fileHandle*)(ulong)(fi->fh);
+
+	fuse_reply_err(req, -pubcfs_writeBack(ctx, pubcfs_getCryptoCtx(ctx), fh->of));
 }
 
 /** Release an open file
@@ -584,246 +870,530 @@ int pubcfs_flush(const char *path, struct fuse_file_info *fi)
  * file: all file descriptors are closed and all memory mappings
  * are unmapped.
  *
- * For every open() call there will be exactly one release() call
- * with the same flags and file descriptor.	 It is possible to
- * have a file opened more than once, in which case only the last
- * release will mean, that no more reads/writes will happen on the
- * file.  The return value of release is ignored.
+ * For every open call there will be exactly one release call. The error of the reply is
+ * ignored by the kernel.
  *
- * Changed in version 2.2
+ * If the file was changed with this handle the next open can keep the data cached by the kernel,
+ * that contains the changes. The write-back changes the times of the backing file after the
+ * writes, so the kernel must ask the attributes again.
  */
-int pubcfs_release(const char *path, struct fuse_file_info *fi)
+void pubcfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	int ris = 0;
+	int ris;
+	pubcfs_fileHandle* fh;
+	pubcfs_context* ctx;
 
-	//Close the file and free all allocated resources.
-	ris = close(fi->fh);
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	fh = (pubcfs_fileHandle*)(ulong)(fi->fh);
 
-	return ris;
+	//Write the dirty blocks, close the file and free all allocated resources.
+	ris = pubcfs_writeBack(ctx, pubcfs_getCryptoCtx(ctx), fh->of);
+	if(ris == 0 && fh->written && ctx->kernelCache > 0){
+		pubcfs_rememberInodeCache(ctx, pubcfs_getInode(ctx, ino));
+		fuse_lowlevel_notify_inval_inode(ctx->session, ino, -1, 0);
+	}
+	//the blocks of a removed file are cached until its last handle is closed
+	pubcfs_invalidateRemoved(ctx, fh->fd);
+	close(fh->fd);
+	pubcfs_destroyFileHandle(ctx, fh);
+
+	fuse_reply_err(req, -ris);
 }
 
 /** Synchronize file contents
  *
  * If the datasync parameter is non-zero, then only the user data
  * should be flushed, not the meta data.
- *
- * Changed in version 2.2
  */
-int pubcfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+void pubcfs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
 	int ris;
+	pubcfs_fileHandle* fh;
+	pubcfs_context* ctx;
+
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	fh = (pubcfs_fileHandle*)(ulong)(fi->fh);
+
+	ris = pubcfs_writeBack(ctx, pubcfs_getCryptoCtx(ctx), fh->of);
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
 	if (datasync)
-		ris = fdatasync(fi->fh);
+		ris = fdatasync(fh->fd);
 	else
-		ris = fsync(fi->fh);
-
-	if(ris < 0) return -errno;
+		ris = fsync(fh->fd);
 
-	return 0;
+	fuse_reply_err(req, (ris < 0) ? errno : 0);
 }
 
-/** Set extended attributes */
-int pubcfs_setxattr(const char *path, const char *name, const char *value, size_t size, int flags)
+/** Find the next data or hole in a file
+ *
+ * The holes of the backing file are holes of the plain file too (see pubcfs_isHole), so after
+ * the write-back of the dirty blocks SEEK_DATA and SEEK_HOLE are done on the backing file.
+ */
+void pubcfs_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence, struct fuse_file_info *fi)
 {
 	int ris;
-	char* e_path;
+	off_t pos;
+	pubcfs_fileHandle* fh;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	fh = (pubcfs_fileHandle*)(ulong)(fi->fh);
 
-	ris = lsetxattr(e_path, name, value, size, flags);
-	free(e_path);
-	if(ris < 0) return -errno;
+	if(whence != SEEK_DATA && whence != SEEK_HOLE){
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
 
-	return 0;
+	ris = pubcfs_writeBack(ctx, pubcfs_getCryptoCtx(ctx), fh->of);
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
+
+	pos = lseek(fh->fd, off, whence);
+	if(pos < 0) fuse_reply_err(req, errno);
+	else fuse_reply_lseek(req, pos);
 }
 
-/** Get extended attributes */
-int pubcfs_getxattr(const char *path, const char *name, char *value, size_t size)
+/** Allocate or deallocate space of an open file
+ *
+ * The supported modes are the ones of pubcfs_allocate: the allocation (with or without
+ * FALLOC_FL_KEEP_SIZE) and FALLOC_FL_PUNCH_HOLE, the others return EOPNOTSUPP. The zeros of the
+ * range are holes of the backing file, so they are never encrypted.
+ */
+void pubcfs_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset, off_t length,
+		struct fuse_file_info *fi)
 {
 	int ris;
-	char* e_path;
+	pubcfs_fileHandle* fh;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	fh = (pubcfs_fileHandle*)(ulong)(fi->fh);
 
-    ris = lgetxattr(e_path, name, value, size);
-	free(e_path);
-	if(ris < 0) return -errno;
+	if(mode != 0 && mode != FALLOC_FL_KEEP_SIZE
+	   && mode != (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE)){
+		fuse_reply_err(req, EOPNOTSUPP);
+		return;
+	}
+	if(offset < 0 || length <= 0){
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
 
-	return 0;
+	ris = pubcfs_allocate(ctx, pubcfs_getCryptoCtx(ctx), fh, mode, offset, length);
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
+	fh->written = true;
+	fuse_reply_err(req, 0);
 }
 
-/** List extended attributes */
-int pubcfs_listxattr(const char *path, char *list, size_t size)
+/** Copy a range of data from an open file to another
+ *
+ * The entire blocks are copied as ciphertext (see pubcfs_copyRange), with a reflink if the backing
+ * file system supports it. The FICLONE ioctls never reach a fuse file system, so cp --reflink
+ * uses this operation too.
+ */
+void pubcfs_copy_file_range(fuse_req_t req, fuse_ino_t ino_in, off_t off_in,
+		struct fuse_file_info *fi_in, fuse_ino_t ino_out, off_t off_out,
+		struct fuse_file_info *fi_out, size_t len, int flags)
 {
-	int ris;
-	char* e_path;
+	ssize_t ris;
+	pubcfs_fileHandle *fhIn, *fhOut;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	fhIn = (pubcfs_fileHandle*)(ulong)(fi_in->fh);
+	fhOut = (pubcfs_fileHandle*)(ulong)(fi_out->fh);
 
-    ris = llistxattr(e_path, list, size);
-	free(e_path);
-	if(ris < 0) return -errno;
+	if(flags != 0){
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
 
-	return 0;
+	ris = pubcfs_copyRange(ctx, pubcfs_getCryptoCtx(ctx), fhIn, off_in, fhOut, off_out, len);
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
+	if(ris > 0) fhOut->written = true;
+	fuse_reply_write(req, ris);
 }
 
-/** Remove extended attributes */
-int pubcfs_removexattr(const char *path, const char *name)
+/** Set extended attributes */
+void pubcfs_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value,
+		size_t size, int flags)
 {
 	int ris;
-	char* e_path;
-	pubcfs_context* ctx;
+	char procPath[PUBCFS_PROCPATH_SIZE];
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	pubcfs_getProcPath(pubcfs_getInode((pubcfs_context*)fuse_req_userdata(req), ino), procPath);
 
-    ris = lremovexattr(e_path, name);
-	free(e_path);
-	if(ris < 0) return -errno;
+	ris = setxattr(procPath, name, value, size, flags);
+	fuse_reply_err(req, (ris < 0) ? errno : 0);
+}
 
-	return 0;
+/** Get extended attributes
+ *
+ * If size is zero, the size of the value is sent with fuse_reply_xattr, otherwise the value.
+ */
+void pubcfs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
+{
+	ssize_t ris;
+	char procPath[PUBCFS_PROCPATH_SIZE];
+	char* value;
+
+	pubcfs_getProcPath(pubcfs_getInode((pubcfs_context*)fuse_req_userdata(req), ino), procPath);
+
+	if(size == 0){
+		ris = getxattr(procPath, name, NULL, 0);
+		if(ris < 0) fuse_reply_err(req, errno);
+		else fuse_reply_xattr(req, ris);
+		return;
+	}
+
+	value = (char*)malloc(size);
+	if(value == NULL){
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	ris = getxattr(procPath, name, value, size);
+	if(ris < 0) fuse_reply_err(req, errno);
+	else fuse_reply_buf(req, value, ris);
+	free(value);
 }
 
-/** Open directory
+/** List extended attribute names
  *
- * Unless the 'default_permissions' mount option is given,
- * this method should check if opendir is permitted for this
- * directory. Optionally opendir may also return an arbitrary
- * filehandle in the fuse_file_info structure, which will be
- * passed to readdir, closedir and fsyncdir.
+ * If size is zero, the size of the list is sent with fuse_reply_xattr, otherwise the list.
+ */
+void pubcfs_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+	ssize_t ris;
+	char procPath[PUBCFS_PROCPATH_SIZE];
+	char* list;
+
+	pubcfs_getProcPath(pubcfs_getInode((pubcfs_context*)fuse_req_userdata(req), ino), procPath);
+
+	if(size == 0){
+		ris = listxattr(procPath, NULL, 0);
+		if(ris < 0) fuse_reply_err(req, errno);
+		else fuse_reply_xattr(req, ris);
+		return;
+	}
+
+	list = (char*)malloc(size);
+	if(list == NULL){
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	ris = listxattr(procPath, list, size);
+	if(ris < 0) fuse_reply_err(req, errno);
+	else fuse_reply_buf(req, list, ris);
+	free(list);
+}
+
+/** Remove extended attributes */
+void pubcfs_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+	int ris;
+	char procPath[PUBCFS_PROCPATH_SIZE];
+
+	pubcfs_getProcPath(pubcfs_getInode((pubcfs_context*)fuse_req_userdata(req), ino), procPath);
+
+	ris = removexattr(procPath, name);
+	fuse_reply_err(req, (ris < 0) ? errno : 0);
+}
+
+/** Open a directory
  *
- * Introduced in version 2.3
+ * The handle of the directory is saved in fi->fh and it is passed to readdir, releasedir and
+ * fsyncdir.
  */
-int pubcfs_opendir(const char *path, struct fuse_file_info *fi)
+void pubcfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	DIR *dp;
-	char* e_path;
+	int fd, err;
+	pubcfs_dirHandle* dh;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
 
-	dp = opendir(e_path);
-	free(e_path);
-	if (dp == NULL) return -errno;
-	fi->fh = (ulong)dp;
+	dh = (pubcfs_dirHandle*)malloc(sizeof(pubcfs_dirHandle));
+	if(dh == NULL){
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
 
-	return 0;
+	fd = openat(pubcfs_getInode(ctx, ino)->fd, ".", O_RDONLY | O_DIRECTORY);
+	if(fd < 0){
+		fuse_reply_err(req, errno);
+		free(dh);
+		return;
+	}
+	dh->dp = fdopendir(fd);
+	if(dh->dp == NULL){
+		err = errno;
+		close(fd);
+		free(dh);
+		fuse_reply_err(req, err);
+		return;
+	}
+	dh->offset = 0;
+	dh->entry = NULL;
+	fi->fh = (ulong)dh;
+
+	if(fuse_reply_open(req, fi) != 0){
+		closedir(dh->dp);
+		free(dh);
+	}
 }
 
-/** Read directory
- *
- * This supersedes the old getdir() interface.  New applications
- * should use this.
- *
- * The filesystem may choose between two modes of operation:
+/** Move an open directory to the entry at the offset, the offsets are the d_off of the entries
  *
- * 1) The readdir implementation ignores the offset parameter, and
- * passes zero to the filler function's offset.  The filler
- * function will not return '1' (unless an error happens), so the
- * whole directory is read in a single readdir operation.  This
- * works just like the old getdir() method.
- *
- * 2) The readdir implementation keeps track of the offsets of the
- * directory entries.  It uses the offset parameter and always
- * passes non-zero offset to the filler function.  When the buffer
- * is full (or an error happens) the filler function will return
- * '1'.
+ * A sequential listing continues from where the last call stopped, also with the entry that
+ * didn't fit in the buffer. Only a different offset (a seek of the application or a restarted
+ * listing) moves the stream with seekdir.
+ */
+private void pubcfs_seekDir(pubcfs_dirHandle* dh, off_t off)
+{
+	if(off == dh->offset) return;
+
+	seekdir(dh->dp, off);
+	dh->entry = NULL;
+	dh->offset = off;
+}
+
+/** Fill the buffer of readdir or readdirplus with the entries that start at the offset
  *
- * Introduced in version 2.3
+ * With plus every entry has the attributes of its file and takes a lookup reference like lookup,
+ * the reference is released if the entry doesn't fit in the buffer. The entries "." and ".." and
+ * the files that can't be looked up (for example because they were removed) have only the inode
+ * number and the type, the kernel looks them up later if it needs them.
  */
-int pubcfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
-		struct fuse_file_info *fi)
+private void pubcfs_fillDir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		struct fuse_file_info *fi, bool plus)
 {
-	DIR *dp;
-	struct dirent *de;
-	char* de_name;
+	int ris;
+	char *buf, *p;
+	char de_name[PUBCFS_NAME_SIZE];
+	size_t remaining, entrySize;
+	off_t nextOffset;
+	struct fuse_entry_param e;
+	pubcfs_inode *parent, *inode;
+	pubcfs_dirHandle* dh;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	dp = (DIR *)(fi->fh);
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	dh = (pubcfs_dirHandle*)(ulong)(fi->fh);
+	parent = pubcfs_getInode(ctx, ino);
 
-	/* The first call of readdir can't return NULL because all directory have the . and .. entry */
-	de = readdir(dp);
-	if(de == NULL) return -errno;
+	buf = (char*)malloc(size);
+	if(buf == NULL){
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
 
-	/* Copy all entry into the buffer */
-	do{
-		de_name = pubcfs_decryptName(ctx, de->d_name);
-		if(de_name == NULL) return -errno;
-		if(filler(buf, de_name, NULL, 0) != 0) return -ENOMEM;
-		free(de_name);
-	}while ((de = readdir(dp)) != NULL);
+	pubcfs_seekDir(dh, off);
+
+	p = buf;
+	remaining = size;
+	while(true){
+		if(dh->entry == NULL){
+			errno = 0;
+			dh->entry = readdir(dh->dp);
+			if(dh->entry == NULL){
+				//an error after some entries is returned by the next call
+				if(errno != 0 && p == buf){
+					fuse_reply_err(req, errno);
+					free(buf);
+					return;
+				}
+				break;
+			}
+		}
 
-	return 0;
+		ris = pubcfs_decryptName(ctx, dh->entry->d_name, de_name, sizeof(de_name));
+		if(ris < 0){
+			if(p == buf){
+				fuse_reply_err(req, -ris);
+				free(buf);
+				return;
+			}
+			break;
+		}
+		nextOffset = dh->entry->d_off;
+
+		memset(&e, 0, sizeof(e));
+		inode = NULL;
+		if(plus && strcmp(dh->entry->d_name, ".") != 0 && strcmp(dh->entry->d_name, "..") != 0){
+			//the name in the backing folder is the name of the entry, it isn't encrypted again
+			inode = pubcfs_lookupInode(ctx, parent, dh->entry->d_name, &(e.attr));
+		}
+		if(inode != NULL){
+			//the size must include the blocks not yet written
+			pubcfs_updateStat(ctx, &(e.attr));
+			e.ino = pubcfs_getNodeid(ctx, inode);
+			e.attr_timeout = ctx->attrTimeout;
+			e.entry_timeout = ctx->entryTimeout;
+		}else{
+			e.attr.st_ino = dh->entry->d_ino;
+			e.attr.st_mode = DTTOIF(dh->entry->d_type);
+		}
+
+		if(plus) entrySize = fuse_add_direntry_plus(req, p, remaining, de_name, &e, nextOffset);
+		else entrySize = fuse_add_direntry(req, p, remaining, de_name, &(e.attr), nextOffset);
+		if(entrySize > remaining){
+			//the entry remains for the next call
+			if(inode != NULL) pubcfs_forgetInode(ctx, inode, 1);
+			break;
+		}
+
+		p += entrySize;
+		remaining -= entrySize;
+		dh->entry = NULL;
+		dh->offset = nextOffset;
+	}
+
+	fuse_reply_buf(req, buf, size - remaining);
+	free(buf);
+}
+
+/** Read directory
+ *
+ * Send a buffer filled using fuse_add_direntry, with size not exceeding the requested size. Send
+ * an empty buffer on end of stream. The offset of every entry is the offset of the next one, so
+ * the next call starts from the entry that didn't fit in the buffer.
+ */
+void pubcfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		struct fuse_file_info *fi)
+{
+	pubcfs_fillDir(req, ino, size, off, fi, false);
 }
 
-/** Release directory
+/** Read directory with attributes
  *
- * Introduced in version 2.3
+ * Like readdir but the entries are filled with fuse_add_direntry_plus, so a listing with the
+ * attributes of the files (ls -l, find) doesn't need a lookup and a getattr for every entry.
  */
-int pubcfs_releasedir(const char *path, struct fuse_file_info *fi)
+void pubcfs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		struct fuse_file_info *fi)
 {
-	DIR *dp;
+	pubcfs_fillDir(req, ino, size, off, fi, true);
+}
 
-	dp = (DIR *)(fi->fh);
-	closedir(dp);
+/** Release an open directory */
+void pubcfs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	pubcfs_dirHandle* dh;
 
-	return 0;
+	dh = (pubcfs_dirHandle*)(ulong)(fi->fh);
+	closedir(dh->dp);
+	free(dh);
+
+	fuse_reply_err(req, 0);
 }
 
 /** Synchronize directory contents
  *
- * If the datasync parameter is non-zero, then only the user data
- * should be flushed, not the meta data
- *
- * Introduced in version 2.3
+ * If the datasync parameter is non-zero, then only the directory
+ * contents should be flushed, not the meta data.
  */
-int pubcfs_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi)
+void pubcfs_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
-	return 0;
+	int ris;
+	pubcfs_dirHandle* dh;
+
+	dh = (pubcfs_dirHandle*)(ulong)(fi->fh);
+
+	if (datasync)
+		ris = fdatasync(dirfd(dh->dp));
+	else
+		ris = fsync(dirfd(dh->dp));
+
+	fuse_reply_err(req, (ris < 0) ? errno : 0);
 }
 
 /**
  * Initialize filesystem
  *
- * The return value will passed in the private_data field of
- * fuse_context to all file operations and as a parameter to the
- * destroy() method.
- *
- * Introduced in version 2.3
- * Changed in version 2.6
+ * The userdata is the pubcfs_context passed to fuse_session_new, the same returned by
+ * fuse_req_userdata to all the operations. It is called after the mount and the fork of
+ * fuse_daemonize.
  */
-void *pubcfs_init(struct fuse_conn_info *conn)
+void pubcfs_init(void *userdata, struct fuse_conn_info *conn)
 {
-	/* fuse_context is set up before this function is called and fuse_get_context()->private_data
-	 * returns the user_data passed to fuse_main().
-	 */
-	return pubcfs_getCtx();
+	pubcfs_context* ctx;
+
+	ctx = (pubcfs_context*)userdata;
+
+	/* with kernelcache the kernel keeps the names and the attributes for a long time and the
+	 * data of the files not changed since their last open, see pubcfs_open */
+	if(ctx->kernelCache > 0){
+		ctx->attrTimeout = ctx->kernelCache;
+		ctx->entryTimeout = ctx->kernelCache;
+	}else{
+		ctx->attrTimeout = PUBCFS_ATTR_TIMEOUT;
+		ctx->entryTimeout = PUBCFS_ENTRY_TIMEOUT;
+	}
+
+	if(conn != NULL){
+		/* with splice the data of the writes is read from the pipe directly into the blocks and
+		 * the data of the reads is given to the kernel without copying it */
+		conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE
+									   | FUSE_CAP_SPLICE_MOVE);
+
+		//the listings return the attributes of the entries, see pubcfs_readdirplus
+		conn->want |= conn->capable & (FUSE_CAP_READDIRPLUS | FUSE_CAP_READDIRPLUS_AUTO);
+
+		/* the truncation of an open must remove the dirty and the cached blocks, so it is done
+		 * by setattr (see pubcfs_open) */
+		conn->want &= ~FUSE_CAP_ATOMIC_O_TRUNC;
+
+		/* with writeback_cache the kernel joins the small writes in its pages and sends them
+		 * later, it reads the partial pages before writing them (see pubcfs_openBackingFile) and
+		 * it sets the mtime of the files with setattr */
+		if(ctx->writebackCache && (conn->capable & FUSE_CAP_WRITEBACK_CACHE)){
+			conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+		}else{
+			conn->want &= ~FUSE_CAP_WRITEBACK_CACHE;
+			ctx->writebackCache = false;
+		}
+	}
+
+	/* the threads are started here and not in main because fuse_daemonize forks the process when
+	 * it runs in background. If the threads can't be created the jobs are simply not executed */
+	ctx->workQueue = workQueue_new(ctx->workers, PUBCFS_WORKQUEUE_MAXJOBS);
+	pubcfs_initCryptoWorkers(ctx);
+	pubcfs_initIoEngine(ctx);
+	pubcfs_initOpenFiles(ctx);
 }
 
 /**
  * Clean up filesystem
  *
  * Called on filesystem exit.
- *
- * Introduced in version 2.3
  */
 void pubcfs_destroy(void *userdata)
 {
-	/*Void*/
+	pubcfs_context* ctx;
+
+	ctx = (pubcfs_context*)userdata;
+	//the waiting jobs are executed before, they can use the cache
+	workQueue_dispose(ctx->workQueue);
+	ctx->workQueue = NULL;
+	pubcfs_disposeOpenFiles(ctx);
+	pubcfs_disposeCryptoWorkers(ctx);
+	blockCache_dispose(ctx->blockCache);
+	ctx->blockCache = NULL;
+	nameCache_dispose(ctx->nameCache);
+	ctx->nameCache = NULL;
+	pubcfs_disposeInodes(ctx);
 }
 
 /**
@@ -832,110 +1402,95 @@ void pubcfs_destroy(void *userdata)
  * This will be called for the access() system call.  If the
  * 'default_permissions' mount option is given, this method is not
  * called.
- *
- * This method is not called under Linux kernel versions 2.4.x
- *
- * Introduced in version 2.5
  */
-int pubcfs_access(const char *path, int mask)
+void pubcfs_access(fuse_req_t req, fuse_ino_t ino, int mask)
 {
 	int ris;
-	char* e_path;
-	pubcfs_context* ctx;
+	char procPath[PUBCFS_PROCPATH_SIZE];
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
+	pubcfs_getProcPath(pubcfs_getInode((pubcfs_context*)fuse_req_userdata(req), ino), procPath);
 
-	ris = access(e_path, mask);
-	free(e_path);
-	if(ris < 0) return -errno;
-
-	return 0;
+	ris = access(procPath, mask);
+	fuse_reply_err(req, (ris < 0) ? errno : 0);
 }
 
 /**
  * Create and open a file
  *
  * If the file does not exist, first create it with the specified
- * mode, and then open it.
- *
- * If this method is not implemented or under Linux kernel
- * versions earlier than 2.6.15, the mknod() and open() methods
- * will be called instead.
- *
- * Introduced in version 2.5
+ * mode, and then open it. The reply contains the entry of the file, like lookup, and its handle.
  */
-int pubcfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+void pubcfs_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+		struct fuse_file_info *fi)
 {
-	int fd;
-	char* e_path;
+	int fd, err, ris;
+	char e_name[PUBCFS_NAME_SIZE];
+	struct fuse_entry_param e;
+	pubcfs_inode *p, *inode;
+	pubcfs_fileHandle* fh;
 	pubcfs_context* ctx;
 
-	ctx = pubcfs_getCtx();
-	e_path = pubcfs_encodePath(ctx, path, true);
-	if(e_path == NULL) return -errno;
-
-	fd = creat(e_path, mode);
-	free(e_path);
-	if(fd < 0) return -errno;
-
-    fi->fh = fd;
-
-	return 0;
-}
+	ctx = (pubcfs_context*)fuse_req_userdata(req);
+	p = pubcfs_getInode(ctx, parent);
+	ris = pubcfs_encryptName(ctx, name, e_name, sizeof(e_name));
+	if(ris < 0){
+		fuse_reply_err(req, -ris);
+		return;
+	}
 
-/**
- * Change the size of an open file
- *
- * This method is called instead of the truncate() method if the
- * truncation was invoked from an ftruncate() system call.
- *
- * If this method is not implemented or under Linux kernel
- * versions earlier than 2.6.15, the truncate() method will be
- * called instead.
- *
- * Introduced in version 2.5
- */
-int pubcfs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi)
-{
-	int ris;
+	fd = pubcfs_openBackingFile(p->fd, e_name, fi->flags | O_CREAT, mode);
+	if(fd < 0){
+		fuse_reply_err(req, errno);
+		return;
+	}
 
-	ris = ftruncate(fi->fh, offset);
-	if (ris < 0) return -errno;
+	memset(&e, 0, sizeof(e));
+	inode = pubcfs_lookupInode(ctx, p, e_name, &(e.attr));
+	if(inode == NULL){
+		err = errno;
+		close(fd);
+		fuse_reply_err(req, err);
+		return;
+	}
 
-	return ris;
-}
+	fh = pubcfs_createFileHandle(ctx, fd);
+	if(fh == NULL){
+		err = errno;
+		close(fd);
+		pubcfs_forgetInode(ctx, inode, 1);
+		fuse_reply_err(req, err);
+		return;
+	}
+	fi->fh = (ulong)fh;
+	pubcfs_setKeepCache(ctx, inode, fd, fi);
 
-/**
- * Get attributes from an open file
- *
- * This method is called instead of the getattr() method if the
- * file information is available.
- *
- * Currently this is only called after the create() method if that
- * is implemented (see above).  Later it may be called for
- * invocations of fstat() too.
- *
- * Introduced in version 2.5
- */
-int pubcfs_fgetattr(const char *path, struct stat *statbuf, struct fuse_file_info *fi)
-{
-	int ris;
+	//a new file can have the inode number of a removed file
+	pubcfs_invalidateBlocks(ctx, fh->dev, fh->ino, 0, BLOCKCACHE_LASTBLOCK);
 
-	ris = fstat(fi->fh, statbuf);
-	if (ris < 0) return -errno;
+	pubcfs_updateStat(ctx, &(e.attr));
+	e.ino = pubcfs_getNodeid(ctx, inode);
+	e.attr_timeout = ctx->attrTimeout;
+	e.entry_timeout = ctx->entryTimeout;
 
-	return ris;
+	if(fuse_reply_create(req, &e, fi) != 0){
+		close(fd);
+		pubcfs_destroyFileHandle(ctx, fh);
+		pubcfs_forgetInode(ctx, inode, 1);
+	}
 }
 
 
 /* ----------------------------------------------------------------------------------- */
 
-private struct fuse_operations pubcfs_operations = {
+private struct fuse_lowlevel_ops pubcfs_operations = {
+	.init = pubcfs_init,
+	.destroy = pubcfs_destroy,
+	.lookup = pubcfs_lookup,
+	.forget = pubcfs_forget,
+	.forget_multi = pubcfs_forget_multi,
 	.getattr = pubcfs_getattr,
+	.setattr = pubcfs_setattr,
 	.readlink = pubcfs_readlink,
-	.getdir = NULL, //because deprecated
 	.mknod = pubcfs_mknod,
 	.mkdir = pubcfs_mkdir,
 	.unlink = pubcfs_unlink,
@@ -943,13 +1498,9 @@ private struct fuse_operations pubcfs_operations = {
 	.symlink = pubcfs_symlink,
 	.rename = pubcfs_rename,
 	.link = pubcfs_link,
-	.chmod = pubcfs_chmod,
-	.chown = pubcfs_chown,
-	.truncate = pubcfs_truncate,
-	.utime = pubcfs_utime,
 	.open = pubcfs_open,
 	.read = pubcfs_read,
-	.write = pubcfs_write,
+	.write_buf = pubcfs_write_buf,
 	.statfs = pubcfs_statfs,
 	.flush = pubcfs_flush,
 	.release = pubcfs_release,
@@ -960,20 +1511,20 @@ private struct fuse_operations pubcfs_operations = {
 	.removexattr = pubcfs_removexattr,
 	.opendir = pubcfs_opendir,
 	.readdir = pubcfs_readdir,
+	.readdirplus = pubcfs_readdirplus,
 	.releasedir = pubcfs_releasedir,
 	.fsyncdir = pubcfs_fsyncdir,
-	.init = pubcfs_init,
-	.destroy = pubcfs_destroy,
 	.access = pubcfs_access,
 	.create = pubcfs_create,
-	.ftruncate = pubcfs_ftruncate,
-	.fgetattr = pubcfs_fgetattr
+	.lseek = pubcfs_lseek,
+	.fallocate = pubcfs_fallocate,
+	.copy_file_range = pubcfs_copy_file_range
 };
 
 /**
  * return the provided fuse operations
  * */
-struct fuse_operations *getPubcFSOperations()
+struct fuse_lowlevel_ops *getPubcFSOperations()
 {
     return &pubcfs_operations;
 }
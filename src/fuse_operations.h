@@ -22,13 +22,19 @@
 	#include <unistd.h>
 	#include <sys/xattr.h>
 	#include <sys/types.h>
+	#include <sys/statvfs.h>
+	#include <limits.h>
 
 	#include <util.h>
 	#include <pubcfs.h>
 
 
-	#include <fuse.h>
+	#include <fuse_lowlevel.h>
 
-	struct fuse_operations *getPubcFSOperations();
+	#define PUBCFS_ATTR_TIMEOUT 1.0 //seconds the kernel keeps the attributes without kernelcache
+	#define PUBCFS_ENTRY_TIMEOUT 1.0 //seconds the kernel keeps the names without kernelcache
+	#define PUBCFS_PROCPATH_SIZE 32 //size of the /proc/self/fd paths of the inodes
+
+	struct fuse_lowlevel_ops *getPubcFSOperations();
 
 #endif
@@ -0,0 +1,268 @@
+/**
+ * @file ioRing.c
+ * @brief batches of reads and writes executed with io_uring or with pread and pwrite
+*/
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+/*
+ * All the operations of a batch are put in the submission queue and submitted with a single
+ * io_uring_enter, that also waits their completions. The operations that transfer less bytes
+ * than requested are submitted again for the rest, like the loops around pread and pwrite.
+ *
+ * The ring is used directly with the system calls, without liburing. When the kernel or the
+ * system doesn't support io_uring ioRing_new returns NULL and ioRing_run executes the operations
+ * with pread and pwrite, and if the ring fails later the operations not done are completed in
+ * the same way.
+ */
+
+#include <ioRing.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#define IORING_SUPPORTED
+		#include <sys/mman.h>
+		#include <linux/io_uring.h>
+	#endif
+#endif
+
+#define IORING_MAXROUNDS 16 //after this number of short transfers the operation is synchronous
+#define IORING_MAXLEN (1U << 30) //max bytes of a single submission
+
+private inline bool ioRing_pending(ioRingOp_t* op){
+	return op->done < op->len && !op->eof && op->err == 0;
+}
+
+/** Set the result of a transfer of an operation */
+private void ioRing_complete(ioRingOp_t* op, ssize_t ris, int err){
+	if(ris < 0){
+		if(err != EINTR && err != EAGAIN) op->err = err;
+	}else if(ris == 0){
+		if(op->write) op->err = EIO;
+		else op->eof = true;
+	}else{
+		op->done += ris;
+	}
+}
+
+/** Execute an operation with pread or pwrite */
+private void ioRing_runSync(ioRingOp_t* op){
+	ssize_t ris;
+
+	while(ioRing_pending(op)){
+		if(op->write) ris = pwrite(op->fd, op->buf + op->done, op->len - op->done, op->offset + op->done);
+		else ris = pread(op->fd, op->buf + op->done, op->len - op->done, op->offset + op->done);
+		ioRing_complete(op, ris, errno);
+	}
+}
+
+/** Create a new ring
+ *
+ * @param entries the max number of operations submitted together, the kernel can round it
+ *
+ * @return the ring, or NULL if io_uring is not available
+ */
+ioRing_t* ioRing_new(uint entries){
+#ifdef IORING_SUPPORTED
+	struct io_uring_params p;
+	ioRing_t* r;
+	bool singleMap;
+
+	r = (ioRing_t*)calloc(1, sizeof(ioRing_t));
+	if(r == NULL) return NULL;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if(r->fd < 0){
+		free(r);
+		return NULL;
+	}
+	r->entries = p.sq_entries;
+
+	//with IORING_FEAT_SINGLE_MMAP the two queues are in the same map
+	r->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(uint);
+	r->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	singleMap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if(singleMap){
+		if(r->cqMapSize > r->sqMapSize) r->sqMapSize = r->cqMapSize;
+		r->cqMapSize = r->sqMapSize;
+	}
+
+	r->sqMap = mmap(NULL, r->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+					IORING_OFF_SQ_RING);
+	if(r->sqMap == MAP_FAILED) goto err1;
+	if(singleMap){
+		r->cqMap = r->sqMap;
+	}else{
+		r->cqMap = mmap(NULL, r->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+						IORING_OFF_CQ_RING);
+		if(r->cqMap == MAP_FAILED) goto err2;
+	}
+	r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+				   IORING_OFF_SQES);
+	if(r->sqes == MAP_FAILED) goto err3;
+
+	r->sqHead = (uint*)((ubyte*)r->sqMap + p.sq_off.head);
+	r->sqTail = (uint*)((ubyte*)r->sqMap + p.sq_off.tail);
+	r->sqMask = (uint*)((ubyte*)r->sqMap + p.sq_off.ring_mask);
+	r->sqArray = (uint*)((ubyte*)r->sqMap + p.sq_off.array);
+	r->cqHead = (uint*)((ubyte*)r->cqMap + p.cq_off.head);
+	r->cqTail = (uint*)((ubyte*)r->cqMap + p.cq_off.tail);
+	r->cqMask = (uint*)((ubyte*)r->cqMap + p.cq_off.ring_mask);
+	r->cqes = (ubyte*)r->cqMap + p.cq_off.cqes;
+	r->broken = false;
+
+	return r;
+
+	//Errors
+	err3:
+		if(!singleMap) munmap(r->cqMap, r->cqMapSize);
+	err2:
+		munmap(r->sqMap, r->sqMapSize);
+	err1:
+		close(r->fd);
+		free(r);
+		return NULL;
+#else
+	return NULL;
+#endif
+}
+
+/** Dispose a ring, no operation must be running */
+void ioRing_dispose(ioRing_t* r){
+#ifdef IORING_SUPPORTED
+	if(r == NULL) return;
+
+	munmap(r->sqes, r->sqesSize);
+	if(r->cqMap != r->sqMap) munmap(r->cqMap, r->cqMapSize);
+	munmap(r->sqMap, r->sqMapSize);
+	close(r->fd);
+	free(r);
+#endif
+}
+
+#ifdef IORING_SUPPORTED
+
+/** Submit the pending operations and wait their completions, in groups of r->entries operations.
+ * If the ring fails it is marked as broken and the operations remain pending */
+private void ioRing_submitAll(ioRing_t* r, ioRingOp_t* ops, size_t count){
+	struct io_uring_sqe* sqe;
+	struct io_uring_cqe* cqe;
+	ioRingOp_t* op;
+	size_t i, n, toSubmit, completed;
+	uint tail, head, idx, len;
+	int ris, round;
+
+	for(round = 0; round < IORING_MAXROUNDS && !r->broken; round++){
+		n = 0;
+		for(i = 0; i < count; ){
+			//fill the submission queue, the kernel consumed all the previous entries
+			tail = *(r->sqTail);
+			for(n = 0; i < count && n < r->entries; i++){
+				op = &(ops[i]);
+				if(!ioRing_pending(op)) continue;
+				len = (op->len - op->done > IORING_MAXLEN) ? IORING_MAXLEN : op->len - op->done;
+
+				idx = tail & *(r->sqMask);
+				sqe = &(((struct io_uring_sqe*)r->sqes)[idx]);
+				memset(sqe, 0, sizeof(struct io_uring_sqe));
+				sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+				sqe->fd = op->fd;
+				sqe->addr = (ulong)(op->buf + op->done);
+				sqe->len = len;
+				sqe->off = op->offset + op->done;
+				sqe->user_data = i;
+				r->sqArray[idx] = idx;
+				tail++;
+				n++;
+			}
+			if(n == 0) break;
+			__atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+
+			//submit and wait, if the ring fails the submitted operations are waited anyway
+			toSubmit = n;
+			completed = 0;
+			while(completed < n){
+				ris = syscall(__NR_io_uring_enter, r->fd, toSubmit, n - completed,
+							  IORING_ENTER_GETEVENTS, NULL, 0);
+				if(ris < 0){
+					if(errno != EINTR && errno != EAGAIN && errno != EBUSY){
+						r->broken = true;
+						if(n - toSubmit == completed) return; //nothing is running
+						toSubmit = 0;
+					}
+				}else{
+					toSubmit -= (ris > (int)toSubmit) ? toSubmit : (size_t)ris;
+				}
+
+				head = *(r->cqHead);
+				while(head != __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)){
+					cqe = &(((struct io_uring_cqe*)r->cqes)[head & *(r->cqMask)]);
+					op = &(ops[cqe->user_data]);
+					if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP){
+						//an old kernel without IORING_OP_READ and IORING_OP_WRITE
+						r->broken = true;
+					}else if(cqe->res < 0){
+						ioRing_complete(op, -1, -cqe->res);
+					}else{
+						ioRing_complete(op, cqe->res, 0);
+					}
+					head++;
+					completed++;
+				}
+				__atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+			}
+		}
+		if(n == 0 && i >= count) break; //nothing pending
+	}
+}
+
+#endif
+
+/** Execute a batch of reads and writes and wait their end
+ *
+ * @param r the ring, NULL for using pread and pwrite
+ * @param ops the operations, done, eof and err are set by this function
+ * @param count the number of operations
+ *
+ * @return 0 if all the operations are ok, -1 if an operation fails (errno is set with its error)
+ */
+int ioRing_run(ioRing_t* r, ioRingOp_t* ops, size_t count){
+	size_t i;
+
+	for(i = 0; i < count; i++){
+		ops[i].done = 0;
+		ops[i].eof = false;
+		ops[i].err = 0;
+	}
+
+#ifdef IORING_SUPPORTED
+	if(r != NULL && !r->broken) ioRing_submitAll(r, ops, count);
+#endif
+
+	//the operations that the ring didn't complete
+	for(i = 0; i < count; i++){
+		if(ioRing_pending(&(ops[i]))) ioRing_runSync(&(ops[i]));
+	}
+
+	for(i = 0; i < count; i++){
+		if(ops[i].err != 0){
+			errno = ops[i].err;
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,63 @@
+/**
+ * @file ioRing.h
+ * @brief batches of reads and writes executed with io_uring or with pread and pwrite
+*/
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+#ifndef IORING_H
+
+	#define IORING_H
+
+	#include <stdlib.h>
+	#include <sys/types.h>
+	#include <util.h>
+
+	/** A read or a write of a batch, the operation is complete when all the bytes are transferred,
+	 * when a read reaches the end of the file or on error */
+	typedef struct {
+		int fd;
+		ubyte* buf;
+		size_t len;
+		off_t offset;
+		bool write;
+		size_t done; //transferred bytes
+		bool eof; //a read reached the end of the file
+		int err; //errno of the operation, 0 if ok
+	} ioRingOp_t;
+
+	/** A submission and a completion queue shared with the kernel, it can't be used by two
+	 * threads at the same time */
+	typedef struct {
+		int fd;
+		uint entries; //max operations submitted together
+		void* sqMap;
+		size_t sqMapSize;
+		void* cqMap;
+		size_t cqMapSize;
+		void* sqes;
+		size_t sqesSize;
+		uint* sqHead;
+		uint* sqTail;
+		uint* sqMask;
+		uint* sqArray;
+		uint* cqHead;
+		uint* cqTail;
+		uint* cqMask;
+		void* cqes;
+		bool broken; //after an error of the ring the operations use pread and pwrite
+	} ioRing_t;
+
+	ioRing_t* ioRing_new(uint entries);
+	void ioRing_dispose(ioRing_t* r);
+
+	int ioRing_run(ioRing_t* r, ioRingOp_t* ops, size_t count);
+
+#endif
@@ -45,7 +45,7 @@ char* mConfig_str_trim(char* in){
 	if(out == NULL) return NULL;
 
   	memcpy(out, start, newSize);
-	out[newSize + 1] = '\0';
+	out[newSize] = '\0';
 
 	return out;
 }
@@ -123,6 +123,7 @@ int mConfig_add(mConfig_t* l, char* name, char* value){
  */
 int mConfig_remove(mConfig_t* l, char* name){
 	mConfigEntry_t* curr;
+	mConfigEntry_t* lNext;
 	int removed;
 
 	if(l == NULL || name == NULL) return 0;
@@ -130,6 +131,7 @@ int mConfig_remove(mConfig_t* l, char* name){
 	removed = 0;
 	curr = l->next;
 	while(curr != l){
+		lNext = curr->next;
 		if(strcmp(curr->name, name) == 0){
 			curr->next->prec = curr->prec;
 			curr->prec->next = curr->next;
@@ -138,7 +140,7 @@ int mConfig_remove(mConfig_t* l, char* name){
 			free(curr);
 			removed++;
 		}
-		curr = curr->next;
+		curr = lNext;
 	}
 
 	return removed;
@@ -220,9 +222,11 @@ int mConfig_readConfig(mConfig_t** nl, char* filename){
 			token = strtok_r(NULL, "\n", &strtok_ctx);
 			value = mConfig_str_trim(token);
 			if(value != NULL){
-				if(mConfig_add(l, name, value) == -1){
-					free(name);
-					free(value);
+				//mConfig_add copies them
+				err = mConfig_add(l, name, value);
+				free(name);
+				free(value);
+				if(err != MCONFIG_NOERR){
 					err = MCONFIG_EADD;
 					goto err3;
 				}
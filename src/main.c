@@ -25,8 +25,7 @@ void pubcfs_main_version(int argc, char** argv){
 		"\n"
 	);
 
-	char* s[2] = {"", "-V"};
-	fuse_main(2, s, NULL, NULL);
+	fuse_lowlevel_version();
 	exit(EXIT_FAILURE);
 }
 
@@ -43,53 +42,212 @@ void pubcfs_main_usage(int argc, char** argv){
 		, argv[0]
 	);
 
-	char* s[2] = {argv[0], "-h"};
-	fuse_main(2, s, NULL, NULL);
+	fuse_cmdline_help();
+	fuse_lowlevel_help();
 	exit(EXIT_FAILURE);
 }
 
-void pubcfs_main_readConfig(pubcfs_context* ctx){
+/** Read a numeric key that can be missing, the configurations of the old folders don't have the
+ * keys added after their creation
+ *
+ * @param defaultValue the value used when the key is missing
+ */
+long pubcfs_main_readOptionalValue(mConfig_t* c, char* key, char* defaultValue){
+	char* buf;
+	long value;
+
+	buf = mConfig_readValue(c, key);
+	if(buf == NULL) return atol(defaultValue);
+	value = atol(buf);
+	free(buf);
+
+	return value;
+}
+
+/** Read the configuration of the folder
+ *
+ * @return false if the configuration is not valid and the folder can't be mounted
+ */
+bool pubcfs_main_readConfig(pubcfs_context* ctx){
 	char* configFilePath;
+	char* journalPath;
 	char* buf;
+	long blockSize;
 	mConfig_t* c;
 
 	//calculate the configuration path
 	configFilePath = (char*)malloc(strlen(ctx->rootPath) + strlen(PUBCFS_CONFIG_PATH) + 2);
-	sprintf(configFilePath, "%s/%s", ctx->rootPath, PUBCFS_CONFIG_PATH);
 	if(configFilePath == NULL){
 		goto err0;
 	}
+	sprintf(configFilePath, "%s/%s", ctx->rootPath, PUBCFS_CONFIG_PATH);
 
 	if(mConfig_readConfig(&c, configFilePath) != MCONFIG_NOERR){
-		fprintf(stderr, "Error (configuration): configuration file reading fail");
+		fprintf(stderr, "Error (configuration): configuration file reading fail\n");
 		goto err1;
 	}
 
 	buf = mConfig_readValue(c, "blocksize");
 	if(buf == NULL){
-		fprintf(stderr, "Error (configuration): blocksize key not found");
-		goto err1;
+		fprintf(stderr, "Error (configuration): blocksize key not found\n");
+		goto err2;
 	}
-	ctx->blockSize = atoi(buf);
-	if(ctx->blockSize < 8){
-		fprintf(stderr, "Error (configuration): blocksize value must be a number bigger than 8");
+	blockSize = atol(buf);
+	free(buf);
+	if(blockSize < PUBCFS_BLOCKSIZE_MIN || blockSize > PUBCFS_BLOCKSIZE_MAX){
+		fprintf(stderr, "Error (configuration): blocksize value must be a number between %d and %d\n",
+				PUBCFS_BLOCKSIZE_MIN, PUBCFS_BLOCKSIZE_MAX);
+		goto err2;
+	}
+	ctx->blockSize = blockSize;
+	if(ctx->blockSize < PUBCFS_BLOCKSIZE_RECOMMENDED){
+		fprintf(stderr, "Warning (configuration): a blocksize of %lu bytes is slow, the folder can be "
+				"converted to %d bytes blocks with the blocksize command of pubcfs-config\n",
+				(ulong)ctx->blockSize, PUBCFS_BLOCKSIZE_RECOMMENDED);
+	}
+
+	ctx->cacheSize = pubcfs_main_readOptionalValue(c, "cachesize", PUBCFS_CONFIG_DEFAULT_CACHESIZE);
+	ctx->nameCacheSize = pubcfs_main_readOptionalValue(c, "namecache", PUBCFS_CONFIG_DEFAULT_NAMECACHE);
+	ctx->readAhead = pubcfs_main_readOptionalValue(c, "readahead", PUBCFS_CONFIG_DEFAULT_READAHEAD);
+	ctx->fadvise = pubcfs_main_readOptionalValue(c, "fadvise", PUBCFS_CONFIG_DEFAULT_FADVISE) != 0;
+	ctx->workers = pubcfs_main_readOptionalValue(c, "workers", PUBCFS_CONFIG_DEFAULT_WORKERS);
+	if(ctx->workers < 1) ctx->workers = 1;
+	ctx->dirtyLimit = pubcfs_main_readOptionalValue(c, "dirtylimit", PUBCFS_CONFIG_DEFAULT_DIRTYLIMIT);
+	ctx->cryptoWorkers = pubcfs_main_readOptionalValue(c, "cryptoworkers",
+													   PUBCFS_CONFIG_DEFAULT_CRYPTOWORKERS);
+	if(ctx->cryptoWorkers < 0){
+		//the thread that reads decrypts a part too
+		ctx->cryptoWorkers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+		if(ctx->cryptoWorkers < 0) ctx->cryptoWorkers = 0;
+	}
+	ctx->parallelCrypt = pubcfs_main_readOptionalValue(c, "parallelcrypt",
+													   PUBCFS_CONFIG_DEFAULT_PARALLELCRYPT);
+
+	buf = mConfig_readValue(c, "ioengine");
+	if(buf == NULL) buf = strdup(PUBCFS_CONFIG_DEFAULT_IOENGINE);
+	if(buf != NULL && strcmp(buf, "uring") == 0){
+		ctx->ioEngine = PUBCFS_IOENGINE_URING;
+	}else if(buf != NULL && strcmp(buf, "sync") == 0){
+		ctx->ioEngine = PUBCFS_IOENGINE_SYNC;
+	}else{
+		fprintf(stderr, "Error (configuration): ioengine value must be sync or uring\n");
+		free(buf);
 		goto err2;
 	}
 	free(buf);
 
+	ctx->kernelCache = pubcfs_main_readOptionalValue(c, "kernelcache",
+													 PUBCFS_CONFIG_DEFAULT_KERNELCACHE);
+	if(ctx->kernelCache < 0) ctx->kernelCache = 0;
+	ctx->writebackCache = pubcfs_main_readOptionalValue(c, "writebackcache",
+														PUBCFS_CONFIG_DEFAULT_WRITEBACKCACHE) != 0;
+
+	buf = mConfig_readValue(c, "cipher");
+	if(buf == NULL) buf = strdup(PUBCFS_CONFIG_DEFAULT_CIPHER);
+	ctx->cipher = (buf != NULL) ? pubcfs_getCipher(buf) : -1;
+	free(buf);
+	if(ctx->cipher < 0){
+		fprintf(stderr, "Error (configuration): cipher value must be cfb8 or xts (ctr is not "
+				"supported, it would encrypt the same block of all the files with the same "
+				"keystream)\n");
+		goto err2;
+	}
+	if(ctx->cipher == PUBCFS_CIPHER_XTS && ctx->blockSize < 16){
+		fprintf(stderr, "Error (configuration): the xts cipher needs a blocksize of at least 16 bytes\n");
+		goto err2;
+	}
+
 	mConfig_dispose(c);
+	free(configFilePath);
 
-	return;
+	//during a block size conversion the files have different block sizes
+	journalPath = (char*)malloc(strlen(ctx->rootPath) + strlen(PUBCFS_RESIZE_JOURNAL_PATH) + 2);
+	if(journalPath == NULL){
+		goto err0;
+	}
+	sprintf(journalPath, "%s/%s", ctx->rootPath, PUBCFS_RESIZE_JOURNAL_PATH);
+	if(access(journalPath, F_OK) == 0){
+		fprintf(stderr, "Error (configuration): a block size conversion was interrupted, complete it "
+				"with the blocksize command of pubcfs-config\n");
+		free(journalPath);
+		goto err0;
+	}
+	free(journalPath);
+
+	//the lock is held until the end of the process, also after fuse_daemonize
+	if(pubcfs_lockFolder(ctx->rootPath) < 0){
+		if(errno == EWOULDBLOCK){
+			fprintf(stderr, "Error: the folder is already mounted or pubcfs-config is converting it\n");
+		}else{
+			fprintf(stderr, "Error: can't lock the folder (%s)\n", strerror(errno));
+		}
+		goto err0;
+	}
+
+	return true;
 
 err2:
-	free(buf);
+	mConfig_dispose(c);
 err1:
 	free(configFilePath);
 err0:
-	return;
+	return false;
 }
 
+/** Mount the folder and serve the requests of the kernel until the unmount
+ *
+ * @param args the fuse arguments, the mount point and the fuse options
+ *
+ * @return the exit status of the program
+ */
+int pubcfs_main_loop(struct fuse_args* args, pubcfs_context* ctx){
+	struct fuse_cmdline_opts opts;
+	struct fuse_loop_config config;
+	struct fuse_session* se;
+	int ris;
+
+	if(fuse_parse_cmdline(args, &opts) != 0){
+		return EXIT_FAILURE;
+	}
+	ris = EXIT_FAILURE;
+	if(opts.mountpoint == NULL){
+		fprintf(stderr, "Error: mountPoint is missing\n");
+		goto err0;
+	}
+
+	se = fuse_session_new(args, getPubcFSOperations(), sizeof(struct fuse_lowlevel_ops), ctx);
+	if(se == NULL){
+		goto err0;
+	}
+	ctx->session = se;
+	if(fuse_set_signal_handlers(se) != 0){
+		goto err1;
+	}
+	if(fuse_session_mount(se, opts.mountpoint) != 0){
+		goto err2;
+	}
+
+	fuse_daemonize(opts.foreground);
+
+	if(opts.singlethread){
+		ris = fuse_session_loop(se);
+	}else{
+		config.clone_fd = opts.clone_fd;
+		config.max_idle_threads = opts.max_idle_threads;
+		ris = fuse_session_loop_mt(se, &config);
+	}
+	ris = (ris == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 
+	fuse_session_unmount(se);
+err2:
+	fuse_remove_signal_handlers(se);
+err1:
+	fuse_session_destroy(se);
+err0:
+	free(opts.mountpoint);
+	fuse_opt_free_args(args);
+	return ris;
+}
 
 int main(int argc, char** argv)
 {
@@ -156,9 +314,17 @@ int main(int argc, char** argv)
 
 	/*end option parsing-------------*/
 
-	pubcfs_main_readConfig(ctx);
+	if(!pubcfs_main_readConfig(ctx)){
+		exit(EXIT_FAILURE);
+	}
 	pubcfs_initRSAModule();
 
+	/* the cache of the decrypted blocks, blockCache_new returns NULL if the cache size is 0 and in
+	 * this case the blocks are always read from the files */
+	ctx->blockCache = blockCache_new(ctx->blockSize, ctx->cacheSize / ctx->blockSize);
+	//the cache of the encrypted names, NULL if its size is 0
+	ctx->nameCache = nameCache_new(ctx->nameCacheSize);
+
 	//read the private key
 	privKey = pubcfs_readPrivateKey(ctx->privateKeyPath);
 	if (privKey == NULL){
@@ -189,12 +355,22 @@ int main(int argc, char** argv)
 		exit(EXIT_FAILURE);
 	}
 
-	/* We create the key for the crypto context and when the thread need it the get function create
-	 * it and assign the created context to the thread specific data pointed by ctx->cryptCtxKey */
-	pthread_key_create(&(ctx->cryptCtxKey), pubcfs_destroyCryptCtx);
+	//the keys of the crypto contexts are derived once here, see pubcfs_initCryptoPool
+	if(pubcfs_initCryptoPool(ctx) != 0){
+		fprintf(stderr, "Error: can't initialize the crypto contexts\n");
+		exit(EXIT_FAILURE);
+	}
+	pthread_key_create(&(ctx->ioRingKey), pubcfs_destroyIoRing);
+
+	/* the kernel identifies the files with the inodes of the table, that starts with the root
+	 * folder */
+	if(pubcfs_initInodes(ctx) != 0){
+		fprintf(stderr, "Error: can't open rootPath\n");
+		exit(EXIT_FAILURE);
+	}
 
-	/* start the fuse module with the created context */
-	return fuse_main(args.argc, args.argv, getPubcFSOperations(), ctx);
+	/* start the fuse session with the created context */
+	return pubcfs_main_loop(&args, ctx);
 
 }
 
@@ -20,7 +20,7 @@
 	#include <util.h>
 	#include <pubcfs.h>
 
-	#include <fuse.h>
+	#include <fuse_lowlevel.h>
 
 	#include <fuse_operations.h>
 
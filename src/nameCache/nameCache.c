@@ -0,0 +1,214 @@
+/**
+ * @file nameCache.c
+ * @brief bounded and sharded LRU cache of the encrypted names
+*/
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+/*
+ * A map from strings to strings with a limit on the memory used by the entries, the keys are
+ * the plain names and the values their encrypted names. The entries are distributed in
+ * NAMECACHE_SHARDS shards like the block cache (see blockCache.c), every shard is an hash table
+ * with its own lock and its own LRU list, and when a shard exceeds its part of the memory its
+ * least recently used entries are removed.
+ */
+
+#include <nameCache.h>
+
+private inline ulong nameCache_hash(const char* key){
+	uint64_t h;
+
+	//FNV-1a
+	h = 0xCBF29CE484222325ULL;
+	while(*key != '\0'){
+		h ^= (ubyte)*key;
+		h *= 0x100000001B3ULL;
+		key++;
+	}
+	h ^= h >> 32;
+
+	return (ulong)h;
+}
+
+private inline nameCacheShard_t* nameCache_shard(nameCache_t* c, ulong hash){
+	return &(c->shards[hash & (NAMECACHE_SHARDS - 1)]);
+}
+
+private inline nameCacheEntry_t** nameCache_bucket(nameCacheShard_t* s, ulong hash){
+	return &(s->buckets[(hash / NAMECACHE_SHARDS) % s->bucketCount]);
+}
+
+private inline void nameCache_lruUnlink(nameCacheEntry_t* e){
+	e->lruPrec->lruNext = e->lruNext;
+	e->lruNext->lruPrec = e->lruPrec;
+}
+
+private inline void nameCache_lruPushFront(nameCacheShard_t* s, nameCacheEntry_t* e){
+	e->lruNext = s->lru.lruNext;
+	e->lruPrec = &(s->lru);
+	s->lru.lruNext->lruPrec = e;
+	s->lru.lruNext = e;
+}
+
+/** Find an entry and the pointer to it in its hash chain, the shard lock must be held
+ *
+ * @return the pointer to the entry in the chain, or NULL
+ */
+private nameCacheEntry_t** nameCache_find(nameCacheShard_t* s, ulong hash, const char* key){
+	nameCacheEntry_t** p;
+
+	for(p = nameCache_bucket(s, hash); *p != NULL; p = &((*p)->hashNext)){
+		if(strcmp((*p)->data, key) == 0) return p;
+	}
+
+	return NULL;
+}
+
+/** Remove an entry, the shard lock must be held
+ *
+ * @param p the pointer to the entry in its hash chain
+ */
+private void nameCache_removeEntry(nameCacheShard_t* s, nameCacheEntry_t** p){
+	nameCacheEntry_t* e;
+
+	e = *p;
+	*p = e->hashNext;
+	nameCache_lruUnlink(e);
+	s->bytes -= e->bytes;
+	free(e);
+}
+
+/** Create a new cache
+ *
+ * @param capacity the maximum bytes of memory used by the entries
+ *
+ * @return the cache, or NULL if there is not enough memory or the capacity is zero
+ */
+nameCache_t* nameCache_new(size_t capacity){
+	nameCache_t* c;
+	nameCacheShard_t* s;
+	int i;
+
+	if(capacity == 0) return NULL;
+
+	c = (nameCache_t*)malloc(sizeof(nameCache_t));
+	if(c == NULL) return NULL;
+
+	for(i = 0; i < NAMECACHE_SHARDS; i++){
+		s = &(c->shards[i]);
+		s->capacity = (capacity + NAMECACHE_SHARDS - 1) / NAMECACHE_SHARDS;
+		s->bucketCount = s->capacity / NAMECACHE_ENTRYSIZE + 1;
+		s->buckets = (nameCacheEntry_t**)calloc(s->bucketCount, sizeof(nameCacheEntry_t*));
+		if(s->buckets == NULL){
+			while(--i >= 0) free(c->shards[i].buckets);
+			free(c);
+			return NULL;
+		}
+		s->lru.lruNext = &(s->lru);
+		s->lru.lruPrec = &(s->lru);
+		s->bytes = 0;
+		pthread_mutex_init(&(s->lock), NULL);
+	}
+
+	return c;
+}
+
+/** Dispose the cache and all its entries */
+void nameCache_dispose(nameCache_t* c){
+	nameCacheShard_t* s;
+	nameCacheEntry_t *e, *next;
+	int i;
+
+	if(c == NULL) return;
+
+	for(i = 0; i < NAMECACHE_SHARDS; i++){
+		s = &(c->shards[i]);
+		for(e = s->lru.lruNext; e != &(s->lru); e = next){
+			next = e->lruNext;
+			free(e);
+		}
+		free(s->buckets);
+		pthread_mutex_destroy(&(s->lock));
+	}
+
+	free(c);
+}
+
+/** Copy the value of a key
+ *
+ * @param value the buffer for the value
+ * @param size the size of the buffer
+ *
+ * @return false if the key is not in the cache or the value is longer than the buffer
+ */
+bool nameCache_get(nameCache_t* c, const char* key, char* value, size_t size){
+	nameCacheShard_t* s;
+	nameCacheEntry_t** p;
+	size_t len;
+	ulong hash;
+
+	hash = nameCache_hash(key);
+	s = nameCache_shard(c, hash);
+
+	pthread_mutex_lock(&(s->lock));
+	p = nameCache_find(s, hash, key);
+	if(p == NULL){
+		pthread_mutex_unlock(&(s->lock));
+		return false;
+	}
+	nameCache_lruUnlink(*p);
+	nameCache_lruPushFront(s, *p);
+	len = strlen((*p)->value);
+	if(len < size) memcpy(value, (*p)->value, len + 1);
+	pthread_mutex_unlock(&(s->lock));
+
+	return len < size;
+}
+
+/** Put a key and its value into the cache, if the shard is full its least recently used entries
+ * are removed. An entry bigger than the shard is not added
+ */
+void nameCache_put(nameCache_t* c, const char* key, const char* value){
+	nameCacheShard_t* s;
+	nameCacheEntry_t** p;
+	nameCacheEntry_t* e;
+	size_t keyLen, valueLen, bytes;
+	ulong hash;
+
+	keyLen = strlen(key);
+	valueLen = strlen(value);
+	bytes = sizeof(nameCacheEntry_t) + keyLen + valueLen + 2;
+	hash = nameCache_hash(key);
+	s = nameCache_shard(c, hash);
+	if(bytes > s->capacity) return;
+
+	//the entry is created without the lock
+	e = (nameCacheEntry_t*)malloc(bytes);
+	if(e == NULL) return;
+	e->bytes = bytes;
+	memcpy(e->data, key, keyLen + 1);
+	e->value = e->data + keyLen + 1;
+	memcpy(e->value, value, valueLen + 1);
+
+	pthread_mutex_lock(&(s->lock));
+	p = nameCache_find(s, hash, key);
+	if(p != NULL) nameCache_removeEntry(s, p);
+	while(s->bytes + bytes > s->capacity){
+		nameCache_removeEntry(s, nameCache_find(s, nameCache_hash(s->lru.lruPrec->data),
+												s->lru.lruPrec->data));
+	}
+
+	p = nameCache_bucket(s, hash);
+	e->hashNext = *p;
+	*p = e;
+	nameCache_lruPushFront(s, e);
+	s->bytes += bytes;
+	pthread_mutex_unlock(&(s->lock));
+}
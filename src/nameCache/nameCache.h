@@ -0,0 +1,59 @@
+/**
+ * @file nameCache.h
+ * @brief bounded and sharded LRU cache of the encrypted names
+*/
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+#ifndef NAMECACHE_H
+
+	#define NAMECACHE_H
+
+	#include <stdlib.h>
+	#include <string.h>
+	#include <stdint.h>
+	#include <pthread.h>
+	#include <util.h>
+
+	/** Number of shards, each shard has its own lock. It must be a power of two */
+	#define NAMECACHE_SHARDS 16
+
+	/** Expected bytes of an entry, used only for choosing the number of buckets */
+	#define NAMECACHE_ENTRYSIZE 128
+
+	typedef struct str_nameCacheEntry{
+		size_t bytes; //memory used by the entry
+		char* value; //it follows the key in data
+		struct str_nameCacheEntry* hashNext;
+		struct str_nameCacheEntry* lruNext;
+		struct str_nameCacheEntry* lruPrec;
+		char data[]; //the key and the value, both terminated by '\0'
+	} nameCacheEntry_t;
+
+	typedef struct {
+		pthread_mutex_t lock;
+		nameCacheEntry_t** buckets;
+		size_t bucketCount;
+		nameCacheEntry_t lru; //sentinel, lru.lruNext is the most recently used entry
+		size_t bytes;
+		size_t capacity; //maximum bytes of the entries
+	} nameCacheShard_t;
+
+	typedef struct {
+		nameCacheShard_t shards[NAMECACHE_SHARDS];
+	} nameCache_t;
+
+	nameCache_t* nameCache_new(size_t capacity);
+	void nameCache_dispose(nameCache_t* c);
+
+	bool nameCache_get(nameCache_t* c, const char* key, char* value, size_t size);
+	void nameCache_put(nameCache_t* c, const char* key, const char* value);
+
+#endif
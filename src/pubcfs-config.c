@@ -54,7 +54,18 @@ int pubcfsConfig_main_usage(int argc, char** argv){
 		"  options: \n"
 		"    rootPath         the path of the crypted folder\n"
 		"\n"
-		, argv[0], argv[0], argv[0], argv[0], argv[0]
+		"blocksize:\n"
+		"  description: convert all the files to a new block size, the folder must not be mounted.\n"
+		"               An interrupted conversion is completed running it again\n"
+		"  use: %s blocksize rootPath user privateKeyPath newBlockSize [threads]\n"
+		"  options: \n"
+		"    rootPath         the path of the crypted folder\n"
+		"    user             user name that exists in the filesystem's users list\n"
+		"    privateKeyPath   the user related private key\n"
+		"    newBlockSize     the new block size in bytes, between %d and %d\n"
+		"    threads          the number of files converted at the same time\n"
+		"\n"
+		, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], PUBCFS_BLOCKSIZE_MIN, PUBCFS_BLOCKSIZE_MAX
 	);
 
 	return true;
@@ -260,6 +271,80 @@ int pubcfsConfig_main_list(char** argv){
 	return true;
 }
 
+int pubcfsConfig_main_blocksize(int argc, char** argv){
+	int ris, threads;
+	long newBlockSize;
+	char *rootPath;
+	char *privKeyPath;
+	char *userName;
+	RSA *privKey;
+
+	//Get the root path (the encrypted folder)
+	rootPath = realpath(argv[2], NULL);
+	if (rootPath == NULL){
+		fprintf(stderr, "Error: rootPath is not a valid path\n");
+		return false;
+	}
+
+	userName = strdup(argv[3]);
+
+	//Get private key path of the user and read it
+	privKeyPath = realpath(argv[4], NULL);
+	if (privKeyPath == NULL){
+		fprintf(stderr, "Error: privateKeyPath is not a valid path\n");
+		return false;
+	}
+	privKey = pubcfs_readPrivateKey(privKeyPath);
+	if (privKey == NULL){
+		fprintf(stderr, "Error: can't load private key\n");
+		return false;
+	}
+
+	newBlockSize = atol(argv[5]);
+	threads = (argc == 7) ? atoi(argv[6]) : sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads < 1) threads = 1;
+
+	ris = pubcfs_changeBlockSize(rootPath, userName, privKey, newBlockSize, threads, stdout);
+	switch(ris){
+		case PUBCFS_ERR_ENOMEM:
+			fprintf(stderr, "Error: no enough memory for the operation\n");
+			return false;
+		case PUBCFS_ERR_BADBLOCKSIZE:
+			fprintf(stderr, "Error: the block size must be between %d and %d, at least 16 with the "
+					"xts cipher\n", PUBCFS_BLOCKSIZE_MIN, PUBCFS_BLOCKSIZE_MAX);
+			return false;
+		case PUBCFS_ERR_RESIZEPENDING:
+			fprintf(stderr, "Error: a conversion to another block size was interrupted, complete it first\n");
+			return false;
+		case PUBCFS_ERR_MOUNTED:
+			fprintf(stderr, "Error: the folder is mounted, unmount it first\n");
+			return false;
+		case PUBCFS_ERR_BADCONFIGFOLDER:
+			fprintf(stderr, "Error: can't read the configuration of the folder\n");
+			return false;
+		case PUBCFS_ERR_NOUSER:
+			fprintf(stderr, "Error: can't find the user\n");
+			return false;
+		case PUBCFS_ERR_DECRYPTFAIL:
+			fprintf(stderr, "Error: can't decrypt the simmetric key with this private key\n");
+			return false;
+		case PUBCFS_ERR_READERROR:
+			fprintf(stderr, "Error: can't read a file, run the command again for completing the conversion\n");
+			return false;
+		case PUBCFS_ERR_WRITEERROR:
+			fprintf(stderr, "Error: can't write a file, run the command again for completing the conversion\n");
+			return false;
+		case PUBCFS_NOERR:
+			break;
+		default:
+			printf("Error: generic error, cannot change the block size\n");
+			return false;
+	}
+
+	printf("the block size has been changed\n");
+	return true;
+}
+
 int main(int argc, char** argv)
 {
 
@@ -292,6 +377,10 @@ int main(int argc, char** argv)
 	}else if ((strcmp(argv[1], "list") == 0) && argc == 3){
 		ret = pubcfsConfig_main_list(argv);
 
+	//blocksize command
+	}else if ((strcmp(argv[1], "blocksize") == 0) && (argc == 6 || argc == 7)){
+		ret = pubcfsConfig_main_blocksize(argc, argv);
+
 	//help command
 	}else if ((strcmp(argv[1], "help") == 0) && argc == 2){
 		ret = pubcfsConfig_main_usage(argc, argv);
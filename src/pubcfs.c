@@ -1,162 +1,302 @@
 #include <pubcfs.h>
 
-/** Returns the absolute path of the relative path and encoded it
+/** Encode a path, the components with the PUBCFS_FILENAME_ENC prefix are encrypted like the names
+ * (see pubcfs_encryptName) and the other ones are copied. The empty components are removed, so the
+ * result doesn't start with '/'
  *
- * @param path relative path, it will be encoded and then used for build the absolute path
+ * @param path the plain path
+ * @param e_path a buffer of PATH_MAX bytes for the encoded path
  *
- * @return a string that you must deallocate with the free function
+ * @return 0 or -errno
  */
-char* pubcfs_encodePath(pubcfs_context* ctx, const char *path, bool addRootPath)
+int pubcfs_encodePath(pubcfs_context* ctx, const char *path, char* e_path)
 {
-	char *ris, *token, *strtok_ctx, *path_cpy, *check;
-	size_t token_len, buf_e64_len;
-	char *buff, *buf_e64;
-	bool firstCicle;
-	pubcfs_cryptoCtx* cctx;
+	char name[PUBCFS_NAME_SIZE];
+	const char *token, *end;
+	size_t len, token_len;
+	int ris;
+
+	len = 0;
+	e_path[0] = '\0';
+	for(token = path; *token != '\0'; token = end){
+		if(*token == '/'){
+			end = token + 1;
+			continue;
+		}
+		end = strchrnul(token, '/');
+		token_len = end - token;
+		if(token_len >= PUBCFS_NAME_SIZE) return -ENAMETOOLONG;
+		memcpy(name, token, token_len);
+		name[token_len] = '\0';
+
+		if(len > 0){
+			if(len + 1 >= PATH_MAX) return -ENAMETOOLONG;
+			e_path[len++] = '/';
+		}
+		ris = pubcfs_encryptName(ctx, name, e_path + len, PATH_MAX - len);
+		if(ris < 0) return ris;
+		len += strlen(e_path + len);
+	}
 
-	cctx = pubcfs_getCryptoCtx(ctx);
-	path_cpy = strdup(path); //because the strtok_r modify it
+	return 0;
+}
+
+/** Decode a path encoded with pubcfs_encodePath, every component is preceded by '/'
+ *
+ * @param e_path the encoded path, it is changed
+ * @param path a buffer of PATH_MAX bytes for the plain path
+ *
+ * @return 0 or -errno
+ */
+int pubcfs_decodePath(pubcfs_context* ctx, char *e_path, char* path)
+{
+	char *token, *strtok_ctx;
+	size_t len;
+	int ris;
 
-	ris = (char*)malloc(addRootPath ? (strlen(ctx->rootPath) + 1) : 1);
-	if (ris == NULL) return NULL;
+	len = 0;
+	path[0] = '\0';
+	token = strtok_r(e_path, "/", &strtok_ctx);
+	while(token != NULL){
+		if(len + 1 >= PATH_MAX) return -ENAMETOOLONG;
+		path[len++] = '/';
+		ris = pubcfs_decryptName(ctx, token, path + len, PATH_MAX - len);
+		if(ris < 0) return ris;
+		len += strlen(path + len);
 
-	//rootPath is in this format "/path/to/folder"
-	if(addRootPath){
-		strcpy(ris, ctx->rootPath);
-		firstCicle = false;
-	}else{
-		ris[0] = '\0';
-		firstCicle = true;
+		token = strtok_r(NULL, "/", &strtok_ctx);
 	}
 
-	token = strtok_r(path_cpy, "/", &strtok_ctx);
-	while(token != NULL){
-		check = strstr(token, PUBCFS_FILENAME_ENC);
-		if(check == token){
-			token = token + PUBCFS_FILENAME_ENC_SIZE; //remove the PUBCFS_FILENAME_ENC prefix
-			token_len = strlen(token);
-			buff = (char*)malloc(token_len + 1);
-			if(buff == NULL){
-				free(ris);
-				if(path_cpy != NULL) free(path_cpy);
-				return NULL;
-			}
-			buff[token_len] = '\0';
+	return 0;
+}
 
-			if(firstCicle){
-				ris = strappend(ris, PUBCFS_FILENAME_ENC);
-				firstCicle = false;
-			}else{
-				ris = strappend(ris, PUBCFS_FILENAME_ENC_WITH_S);
-			}
-			pubcfs_encrypt(&(cctx->en), (uchar*)token, (uchar*)buff, token_len);
-			base64_encode((ubyte*)buff, (uchar**)(&buf_e64), token_len, &buf_e64_len, base64_OPT_FILENAMESAFE);
-			free(buff);
-			ris = strappend(ris, buf_e64);
-		}else{
-			if(!firstCicle){
-				ris = strappend(ris, "/");
-			}else{
-				firstCicle = false;
-			}
-			ris = strappend(ris, token);
-		}
+/** Decrypt a name of the backing folder, for example the name of a file in the root directory
+ * that is encrypted. The names without the PUBCFS_FILENAME_ENC prefix, or that are not valid
+ * base64, are copied
+ *
+ * @param name the encrypted name
+ * @param de_name the buffer for the plain name, the plain name is not longer than name
+ * @param size the size of the buffer
+ *
+ * @return 0 or -ENAMETOOLONG
+ */
+int pubcfs_decryptName(pubcfs_context* ctx, const char *name, char* de_name, size_t size)
+{
+	size_t name_len, buff_len;
+	ubyte* buff;
+	pubcfs_cryptoCtx* cctx;
 
-		token = strtok_r(NULL, "/", &strtok_ctx);
+	name_len = strlen(name);
+	if(name_len >= size) return -ENAMETOOLONG;
+
+	//this is the case that the name isn't encrypted
+	if(strncmp(name, PUBCFS_FILENAME_ENC, PUBCFS_FILENAME_ENC_SIZE) == 0){
+		//the decoded name is shorter, so it is decrypted in place in de_name
+		buff = (ubyte*)(de_name + PUBCFS_FILENAME_ENC_SIZE);
+		if(base64_decodeBuf((uchar*)(name + PUBCFS_FILENAME_ENC_SIZE), buff,
+							name_len - PUBCFS_FILENAME_ENC_SIZE, &buff_len, base64_OPT_FILENAMESAFE)){
+			cctx = pubcfs_getCryptoCtx(ctx);
+			memcpy(de_name, PUBCFS_FILENAME_ENC, PUBCFS_FILENAME_ENC_SIZE);
+			pubcfs_decryptCfb8(cctx, NULL, buff, buff, buff_len);
+			de_name[PUBCFS_FILENAME_ENC_SIZE + buff_len] = '\0';
+			return 0;
+		}
 	}
 
-	if(path_cpy != NULL) free(path_cpy);
+	memcpy(de_name, name, name_len + 1);
 
-	return ris;
+	return 0;
 }
 
-/** Returns decrypted name of an encoded name, for example the name of a file in the root directory
- * that is encrypted.
+/** Encrypt a single name for the backing folder, the names with the PUBCFS_FILENAME_ENC prefix
+ * are encrypted and base64 encoded after the prefix, the other names are copied
+ *
+ * The encrypted names are kept in the name cache. The encryption of a name depends only on the
+ * name and the key, so the entries remain valid when the files are renamed or removed.
  *
- * @param name the string that contain the name to decrypt
+ * @param name the plain name, it must not contain '/'
+ * @param e_name the buffer for the name in the backing folder, PUBCFS_NAME_SIZE bytes are enough
+ * 				 for all the names that the backing folder can contain
+ * @param size the size of the buffer
  *
- * @return a string that you must deallocate with the free function
+ * @return 0 or -ENAMETOOLONG
  */
-char* pubcfs_decryptName(pubcfs_context* ctx, const char *name)
+int pubcfs_encryptName(pubcfs_context* ctx, const char *name, char* e_name, size_t size)
 {
-	char *buff, *buff2, *check;
-	size_t buff_len;
+	ubyte buff[PUBCFS_NAME_SIZE];
+	const char* plain;
+	size_t name_len, buf_e64_len;
 	pubcfs_cryptoCtx* cctx;
 
-	cctx = pubcfs_getCryptoCtx(ctx);
+	name_len = strlen(name);
 
 	//this is the case that the name isn't encrypted
-	check = strstr(name, PUBCFS_FILENAME_ENC);
-	if(check == name){
-
-		name = name + PUBCFS_FILENAME_ENC_SIZE;
-
-		base64_decode((uchar*)name, (uchar**)(&buff), strlen(name), &buff_len, base64_OPT_FILENAMESAFE);
-		buff2 = malloc(buff_len + 1 + PUBCFS_FILENAME_ENC_SIZE);
-		if(buff2 != NULL){
-			strcpy(buff2, PUBCFS_FILENAME_ENC);
-			pubcfs_decrypt(&(cctx->de), (uchar*)buff, (uchar*)(buff2 + PUBCFS_FILENAME_ENC_SIZE), buff_len);
-			buff2[buff_len + PUBCFS_FILENAME_ENC_SIZE] = '\0';
-		}else{
-			buff2 = NULL;
+	if(strncmp(name, PUBCFS_FILENAME_ENC, PUBCFS_FILENAME_ENC_SIZE) != 0){
+		if(name_len >= size) return -ENAMETOOLONG;
+		memcpy(e_name, name, name_len + 1);
+		return 0;
+	}
+
+	if(ctx->nameCache != NULL && nameCache_get(ctx->nameCache, name, e_name, size)) return 0;
+
+	plain = name + PUBCFS_FILENAME_ENC_SIZE;
+	name_len -= PUBCFS_FILENAME_ENC_SIZE;
+	if(name_len >= sizeof(buff) ||
+	   PUBCFS_FILENAME_ENC_SIZE + base64_encodedLength(name_len, base64_OPT_FILENAMESAFE) >= size){
+		return -ENAMETOOLONG;
+	}
+
+	cctx = pubcfs_getCryptoCtx(ctx);
+	pubcfs_encrypt(&(cctx->en), (uchar*)plain, buff, name_len);
+	memcpy(e_name, PUBCFS_FILENAME_ENC, PUBCFS_FILENAME_ENC_SIZE);
+	base64_encodeBuf(buff, (uchar*)(e_name + PUBCFS_FILENAME_ENC_SIZE), name_len, &buf_e64_len,
+					 base64_OPT_FILENAMESAFE);
+	if(ctx->nameCache != NULL) nameCache_put(ctx->nameCache, name, e_name);
+
+	return 0;
+}
+
+/** Read consecutive blocks from the file and decode them
+ *
+ * The entire blocks are taken from the block cache if they are there. The other blocks are read
+ * with a single read for every run of consecutive blocks, decoded in place and then added to
+ * the cache. The reads of all the runs are executed together by ioRing_run.
+ *
+ * @param ctx pubcfs_context that have all the current context
+ * @param cctx pubcfs_cryptoCtx that have the crypto context
+ * @param fh the handle of the file to read
+ * @param first the first block to read
+ * @param count the number of blocks
+ * @param de_buf pointer to a ubyte array that will contain the readed blocks, this buffer must be
+ * allocated before with a size of count * ctx->blockSize
+ * @param sizes array of count elements. In input the blocks with a size of -1 are read and the
+ * others are skipped because they are already in de_buf. In output it contains the readed bytes
+ * of every block, they are less than the blocksize only at the end of the file
+ *
+ * @return 0 or -1 if error (errno is set)
+ */
+int pubcfs_readBlocks(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+					  ulong first, size_t count, ubyte* de_buf, int* sizes)
+{
+	size_t i, j, k, r, runs, readed, blockSize;
+	ulong* generations;
+	ioRingOp_t* ops;
+
+	blockSize = ctx->blockSize;
+	generations = NULL;
+
+	if(ctx->blockCache != NULL){
+		generations = (ulong*)malloc(count * sizeof(ulong));
+		if(generations == NULL) return -1;
+		for(i = 0; i < count; i++){
+			if(sizes[i] >= 0) continue;
+			//on miss the generation is taken before the read, see blockCache_put
+			if(blockCache_get(ctx->blockCache, fh->dev, fh->ino, first + i,
+							  de_buf + i * blockSize, &(generations[i]))){
+				sizes[i] = blockSize;
+			}
 		}
+	}
 
-		free(buff);
-	}else{
-		buff2 = malloc(strlen(name) + 1);
-		if (buff2 != NULL){
-			strcpy(buff2, name);
-		}else{
-			buff2 = NULL;
+	runs = 0;
+	for(i = 0; i < count; i++){
+		if(sizes[i] < 0 && (i == 0 || sizes[i - 1] >= 0)) runs++;
+	}
+	if(runs == 0){
+		free(generations);
+		return 0;
+	}
+	ops = (ioRingOp_t*)malloc(runs * sizeof(ioRingOp_t));
+	if(ops == NULL){
+		free(generations);
+		return -1;
+	}
+
+	//a read for every run of consecutive blocks, the read stops only at the end of the file
+	r = 0;
+	for(i = 0; i < count; i = j){
+		if(sizes[i] >= 0){
+			j = i + 1;
+			continue;
 		}
+		for(j = i + 1; j < count && sizes[j] < 0; j++);
+
+		ops[r].fd = fh->fd;
+		ops[r].buf = de_buf + i * blockSize;
+		ops[r].len = (j - i) * blockSize;
+		ops[r].offset = (first + i) * blockSize;
+		ops[r].write = false;
+		r++;
 	}
 
-	return buff2;
+	//with io_uring all the runs are submitted together
+	if(ioRing_run(pubcfs_getIoRing(ctx), ops, runs) != 0){
+		free(ops);
+		free(generations);
+		return -1;
+	}
+
+	for(r = 0; r < runs; r++){
+		i = ops[r].offset / blockSize - first;
+		j = i + ops[r].len / blockSize;
+		readed = ops[r].done;
+
+		//the big runs are decrypted with more threads
+		pubcfs_cryptBlocks(ctx, cctx, false, first + i, de_buf + i * blockSize, de_buf + i * blockSize,
+						   readed);
+
+		for(k = i; k < j; k++){
+			if(readed >= (k - i + 1) * blockSize) sizes[k] = blockSize;
+			else if(readed > (k - i) * blockSize) sizes[k] = readed - (k - i) * blockSize;
+			else sizes[k] = 0;
+
+			//only the entire blocks are cached, the last block of the file can grow
+			if(ctx->blockCache != NULL && sizes[k] == blockSize){
+				blockCache_put(ctx->blockCache, fh->dev, fh->ino, first + k,
+							   de_buf + k * blockSize, generations[k]);
+			}
+		}
+	}
+
+	free(ops);
+	free(generations);
+	return 0;
 }
 
-/** Read a block from the file and decode it
+/** Read a block from the file and decode it, see pubcfs_readBlocks
  *
  * @param ctx pubcfs_context that have all the current context
  * @param cctx pubcfs_cryptoCtx that have the crypto context
- * @param fp the file pointer of the file to read
+ * @param fh the handle of the file to read
  * @param block the block to read
  * @param de_buf pointer to a ubyte array that will contain the readed block, this buffer must be
  * allocated before with a size of ctx->blockSize
  *
  * @return the readed bytes or -1 if error
  */
-int pubcfs_readBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, int fp,
+int pubcfs_readBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
 					 ulong block, ubyte* de_buf)
 {
-    int ris;
-    ubyte* e_buf;
+	int size;
 
-    e_buf = (ubyte*)malloc(ctx->blockSize);
-    if(e_buf == NULL) return -1;
+	size = -1;
+	if(pubcfs_readBlocks(ctx, cctx, fh, block, 1, de_buf, &size) != 0) return -1;
 
-    ris = pread(fp, e_buf, ctx->blockSize, block * ctx->blockSize);
-	if(ris < 0){
-		return -1;
-	}
-
-	pubcfs_decrypt(&(cctx->de), e_buf, de_buf, ris);
-
-	free(e_buf);
-    return ris;
+	return size;
 }
 
 /** Encode and Write a block to the file
  *
  * @param ctx pubcfs_context that have all the current context
  * @param cctx pubcfs_cryptoCtx that have the crypto context
- * @param fp the file pointer of the file to read
+ * @param fh the handle of the file to write
  * @param block the block to read
  * @param de_buf pointer to a ubyte array that contain the block to write
  * @param size is usually equals to 'blocksize' but it can be less in the end of file
  *
  * @return the writed bytes or -1 if error
  */
-int pubcfs_writeBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, int fp,
+int pubcfs_writeBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
 					  ulong block, ubyte* de_buf, size_t size)
 {
     int ris;
@@ -165,24 +305,217 @@ int pubcfs_writeBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, int fp,
     e_buf = (ubyte*)malloc(size);
     if(e_buf == NULL) return -1;
 
-	pubcfs_encrypt(&(cctx->en), de_buf, e_buf, size);
-    ris = pwrite(fp, e_buf, size, block * ctx->blockSize);
+	pubcfs_encryptBlock(ctx, cctx, block, de_buf, e_buf, size);
+    ris = pwrite(fh->fd, e_buf, size, block * ctx->blockSize);
+
+    //the cached block is invalidated after the write, see blockCache_put
+    pubcfs_invalidateBlocks(ctx, fh->dev, fh->ino, block, block);
 
     free(e_buf);
     return ris;
 }
 
-/** Get the pubcfs_context context, it is taken using the fuse_get_context function
- * @return the context, you cannot deallocate it
- *  */
-pubcfs_context* pubcfs_getCtx(){
-	return (pubcfs_context*)fuse_get_context()->private_data;
+/** Create the handle of an opened file, it is saved in the fh field of fuse_file_info
+ *
+ * @param fd the file descriptor of the backing file
+ *
+ * @return the handle, or NULL on error (errno is set)
+ */
+pubcfs_fileHandle* pubcfs_createFileHandle(pubcfs_context* ctx, int fd){
+	pubcfs_fileHandle* fh;
+	struct stat st;
+
+	if(fstat(fd, &st) != 0) return NULL;
+
+	fh = (pubcfs_fileHandle*)malloc(sizeof(pubcfs_fileHandle));
+	if(fh == NULL){
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	fh->fd = fd;
+	fh->dev = st.st_dev;
+	fh->ino = st.st_ino;
+	fh->of = pubcfs_getOpenFile(ctx, st.st_dev, st.st_ino, st.st_size, true);
+	if(fh->of == NULL){
+		free(fh);
+		return NULL;
+	}
+	pthread_mutex_init(&(fh->lock), NULL);
+	fh->raNext = 0;
+	fh->raWindow = 0;
+	fh->raEnd = 0;
+	fh->written = false;
+
+	return fh;
+}
+
+/** Destroy the handle of a file, the file descriptor is not closed */
+void pubcfs_destroyFileHandle(pubcfs_context* ctx, pubcfs_fileHandle* fh){
+	pubcfs_putOpenFile(ctx, fh->of);
+	pthread_mutex_destroy(&(fh->lock));
+	free(fh);
+}
+
+/** Invalidate the cached blocks of a file from first to last (included), it must be called
+ * after that the file is changed
+ *
+ * @param last the last block to invalidate, BLOCKCACHE_LASTBLOCK for all the blocks after first
+ */
+void pubcfs_invalidateBlocks(pubcfs_context* ctx, dev_t dev, ino_t ino, ulong first, ulong last){
+	if(ctx->blockCache == NULL) return;
+	blockCache_invalidate(ctx->blockCache, dev, ino, first, last);
+}
+
+/** Invalidate all the cached blocks of a file if it was removed, because its inode number can be
+ * given to a new file. It must be called when a descriptor of the file is closed, after the last
+ * read that can put its blocks into the cache
+ *
+ * @param fd a descriptor of the backing file, also O_PATH
+ */
+void pubcfs_invalidateRemoved(pubcfs_context* ctx, int fd){
+	struct stat st;
+
+	if(ctx->blockCache == NULL) return;
+	if(fstat(fd, &st) == 0 && st.st_nlink == 0){
+		blockCache_invalidate(ctx->blockCache, st.st_dev, st.st_ino, 0, BLOCKCACHE_LASTBLOCK);
+	}
+}
+
+typedef struct {
+	pubcfs_context* ctx;
+	pubcfs_fileHandle fh; //it has a duplicated descriptor, so the file can be closed meanwhile
+	ulong first;
+	ulong last;
+} pubcfs_readAheadJob;
+
+/** Read the blocks of a read-ahead job and put them into the block cache, it is executed by the
+ * threads of the work queue */
+private void pubcfs_readAheadWorker(void* arg){
+	pubcfs_readAheadJob* job;
+	pubcfs_cryptoCtx* cctx;
+	ubyte* buf;
+	int* sizes;
+	ulong block;
+	size_t i, count, maxCount;
+
+	job = (pubcfs_readAheadJob*)arg;
+	cctx = pubcfs_getCryptoCtx(job->ctx);
+
+	//the window is read in pieces of PUBCFS_IO_MAXSPAN bytes
+	maxCount = PUBCFS_IO_MAXSPAN / job->ctx->blockSize;
+	if(maxCount == 0) maxCount = 1;
+	if(maxCount > job->last - job->first) maxCount = job->last - job->first;
+	sizes = (int*)malloc(maxCount * (sizeof(int) + job->ctx->blockSize));
+
+	if(sizes != NULL){
+		buf = (ubyte*)(sizes + maxCount);
+		for(block = job->first; block < job->last; block += count){
+			count = job->last - block;
+			if(count > maxCount) count = maxCount;
+			for(i = 0; i < count; i++) sizes[i] = -1;
+
+			//pubcfs_readBlocks puts the blocks into the cache
+			if(pubcfs_readBlocks(job->ctx, cctx, &(job->fh), block, count, buf, sizes) != 0) break;
+			if(sizes[count - 1] < (int)job->ctx->blockSize) break; //end of file
+		}
+		free(sizes);
+	}
+
+	//the file can be removed and closed by all the handles meanwhile
+	pubcfs_invalidateRemoved(job->ctx, job->fh.fd);
+	close(job->fh.fd);
+	free(job);
+}
+
+/** Detect the sequential reads of an open file and read in advance the next blocks
+ *
+ * When a read starts where the previous one ended the window of the blocks to read in advance
+ * grows (it doubles until ctx->readAhead bytes), otherwise it is reset. The blocks of the window
+ * are read and decrypted by the work queue and saved into the block cache, where the next reads
+ * find them. It must be called before serving the read.
+ *
+ * @param fh the handle of the file
+ * @param offset the offset of the read
+ * @param count the size of the read
+ */
+void pubcfs_readAhead(pubcfs_context* ctx, pubcfs_fileHandle* fh, off_t offset, size_t count){
+	pubcfs_readAheadJob* job;
+	ulong maxWindow, first, last;
+	int fd;
+
+	if(ctx->readAhead == 0 || (ctx->blockCache == NULL && !ctx->fadvise)) return;
+	maxWindow = (ctx->readAhead + ctx->blockSize - 1) / ctx->blockSize;
+
+	pthread_mutex_lock(&(fh->lock));
+	if(offset != fh->raNext){
+		//random access, stop reading in advance
+		fh->raNext = offset + count;
+		fh->raWindow = 0;
+		fh->raEnd = 0;
+		pthread_mutex_unlock(&(fh->lock));
+		return;
+	}
+	fh->raNext = offset + count;
+
+	if(fh->raWindow == 0){
+		//the first window is twice the request
+		fh->raWindow = 2 * ((count + ctx->blockSize - 1) / ctx->blockSize);
+	}else{
+		fh->raWindow = fh->raWindow * 2;
+	}
+	if(fh->raWindow > maxWindow) fh->raWindow = maxWindow;
+
+	/* the blocks after the request, the next window is requested only when less than half of the
+	 * current one is still ahead of the reader */
+	first = (offset + count + ctx->blockSize - 1) / ctx->blockSize;
+	last = first + fh->raWindow;
+	if(fh->raEnd > first){
+		if(fh->raEnd - first > fh->raWindow / 2){
+			pthread_mutex_unlock(&(fh->lock));
+			return;
+		}
+		first = fh->raEnd;
+	}
+	fh->raEnd = last;
+	pthread_mutex_unlock(&(fh->lock));
+
+	if(ctx->fadvise){
+		posix_fadvise(fh->fd, first * ctx->blockSize, (last - first) * ctx->blockSize,
+					  POSIX_FADV_WILLNEED);
+	}
+
+	if(ctx->blockCache == NULL || ctx->workQueue == NULL) return;
+
+	fd = dup(fh->fd);
+	if(fd < 0) return;
+	job = (pubcfs_readAheadJob*)malloc(sizeof(pubcfs_readAheadJob));
+	if(job == NULL){
+		close(fd);
+		return;
+	}
+	job->ctx = ctx;
+	job->fh.fd = fd;
+	job->fh.dev = fh->dev;
+	job->fh.ino = fh->ino;
+	job->fh.of = NULL; //the job reads only the blocks in the file
+	job->first = first;
+	job->last = last;
+
+	//when the threads are busy the read-ahead is useless, so the job is dropped
+	if(!workQueue_tryPush(ctx->workQueue, pubcfs_readAheadWorker, job)){
+		close(fd);
+		free(job);
+		pthread_mutex_lock(&(fh->lock));
+		fh->raEnd = 0;
+		pthread_mutex_unlock(&(fh->lock));
+	}
 }
 
 /** Get the pubcfs_cryptoCtx that contain all the crypto context
  * This context is separated from the normal context because in multithread situations the crypto
  * algorithm have some problems. For this problem the context is a Thread Specific Data and it
- * is created for each thread that need it
+ * is taken from the pool (see pubcfs_initCryptoPool) by each thread that need it
  *
  * @param ctx pubcfs_context that have all the current context
  *
@@ -200,21 +533,82 @@ pubcfs_cryptoCtx* pubcfs_getCryptoCtx(pubcfs_context* ctx){
     return cctx;
 }
 
-/** Create a new crypto context, this function should be call only by the pubcfs_getCryptoCtx
- * function because this context have some problem with multithread
+/** Choose the engine for the reads and the writes of the files. If io_uring is requested but it
+ * is not available the blocking system calls are used
+ *
+ * @param ctx pubcfs_context that have all the current context
+ */
+void pubcfs_initIoEngine(pubcfs_context* ctx){
+	ioRing_t* r;
+
+	if(ctx->ioEngine != PUBCFS_IOENGINE_URING) return;
+
+	r = ioRing_new(PUBCFS_IORING_ENTRIES);
+	if(r == NULL){
+		fprintf(stderr, "Warning: io_uring is not available, the files are read with pread\n");
+		ctx->ioEngine = PUBCFS_IOENGINE_SYNC;
+		return;
+	}
+	pthread_setspecific(ctx->ioRingKey, r);
+}
+
+/** Returns the io_uring ring of the thread, the rings are created like the crypto contexts
  *
  * @param ctx pubcfs_context that have all the current context
  *
- * @return the crypto context, you cannot deallocate it
+ * @return the ring or NULL if the blocking system calls are used, you cannot deallocate it
  */
-pubcfs_cryptoCtx* pubcfs_createCryptoCtx(pubcfs_context* ctx){
+ioRing_t* pubcfs_getIoRing(pubcfs_context* ctx){
+	ioRing_t* r;
+
+	if(ctx->ioEngine != PUBCFS_IOENGINE_URING) return NULL;
+
+	r = (ioRing_t*)pthread_getspecific(ctx->ioRingKey);
+	if(r == NULL){
+		r = ioRing_new(PUBCFS_IORING_ENTRIES);
+		pthread_setspecific(ctx->ioRingKey, r);
+	}
+
+	return r;
+}
+
+/** Destroy the ring of a thread, see 'pthread_key_create'
+ */
+void pubcfs_destroyIoRing(void* r){
+	ioRing_dispose((ioRing_t*)r);
+}
+
+/** Free a crypto context and the state of its EVP contexts */
+private void pubcfs_freeCryptoCtx(pubcfs_cryptoCtx* cctx){
+	EVP_CIPHER_CTX_cleanup(&(cctx->en));
+	EVP_CIPHER_CTX_cleanup(&(cctx->de));
+	EVP_CIPHER_CTX_cleanup(&(cctx->ecb));
+	if(cctx->blockCipher){
+		EVP_CIPHER_CTX_cleanup(&(cctx->blockEn));
+		EVP_CIPHER_CTX_cleanup(&(cctx->blockDe));
+	}
+	free(cctx);
+}
+
+/** Derive the keys from the simmetric key and create the model of the crypto contexts, it is
+ * done only once by pubcfs_initCryptoPool
+ *
+ * @param ctx pubcfs_context that have all the current context
+ *
+ * @return the crypto context or NULL if error
+ */
+private pubcfs_cryptoCtx* pubcfs_deriveCryptoCtx(pubcfs_context* ctx){
 	uchar* key;
 	size_t keyLength;
-	EVP_CIPHER_CTX en, de;
-	pubcfs_cryptoCtx* cctx = (pubcfs_cryptoCtx*)malloc(sizeof(pubcfs_cryptoCtx));
+	const EVP_CIPHER* blockCipher;
+	pubcfs_cryptoCtx* cctx;
 	int i, count = 5;
 	uchar keyv[32];
 	uchar iv[32]; //inizialization vector http://en.wikipedia.org/wiki/Initialization_vector
+	uchar blockKey[EVP_MAX_KEY_LENGTH];
+
+	cctx = (pubcfs_cryptoCtx*)malloc(sizeof(pubcfs_cryptoCtx));
+	if(cctx == NULL) return NULL;
 
 	key = ctx->key;
 	keyLength = ctx->keyLen;
@@ -239,22 +633,148 @@ pubcfs_cryptoCtx* pubcfs_createCryptoCtx(pubcfs_context* ctx){
 		return NULL;
 	}
 
-	EVP_CIPHER_CTX_init(&en);
-	EVP_EncryptInit_ex(&en, EVP_aes_256_cfb8(), NULL, key, iv);
-	EVP_CIPHER_CTX_init(&de);
-	EVP_DecryptInit_ex(&de, EVP_aes_256_cfb8(), NULL, key, iv);
+	EVP_CIPHER_CTX_init(&(cctx->en));
+	EVP_EncryptInit_ex(&(cctx->en), EVP_aes_256_cfb8(), NULL, key, iv);
+	EVP_CIPHER_CTX_init(&(cctx->de));
+	EVP_DecryptInit_ex(&(cctx->de), EVP_aes_256_cfb8(), NULL, key, iv);
+
+	//the decryption of cfb8 is done with ecb, see pubcfs_decryptCfb8
+	EVP_CIPHER_CTX_init(&(cctx->ecb));
+	EVP_EncryptInit_ex(&(cctx->ecb), EVP_aes_256_ecb(), NULL, key, NULL);
+	EVP_CIPHER_CTX_set_padding(&(cctx->ecb), 0);
+	memcpy(cctx->cfb8Iv, iv, 16);
+
+	cctx->blockCipher = (ctx->cipher != PUBCFS_CIPHER_CFB8);
+	if(!cctx->blockCipher) return cctx;
+
+	/* The blocks of the files use xts, the key is derived like the cfb8 one and the tweak is given
+	 * for every block by pubcfs_encryptBlock. xts uses two aes keys, so the derived key has 64
+	 * bytes */
+	blockCipher = EVP_aes_256_xts();
+	i = EVP_BytesToKey(blockCipher, EVP_sha1(), NULL, key, keyLength, count, blockKey, iv);
+	if (i != EVP_CIPHER_key_length(blockCipher)) {
+		cctx->blockCipher = false;
+		pubcfs_freeCryptoCtx(cctx);
+		return NULL;
+	}
+
+	EVP_CIPHER_CTX_init(&(cctx->blockEn));
+	EVP_EncryptInit_ex(&(cctx->blockEn), blockCipher, NULL, blockKey, NULL);
+	EVP_CIPHER_CTX_init(&(cctx->blockDe));
+	EVP_DecryptInit_ex(&(cctx->blockDe), blockCipher, NULL, blockKey, NULL);
+	memset(blockKey, 0, sizeof(blockKey));
+
+	return cctx;
+}
+
+/** Create the pool of the crypto contexts, it must be called once after that the simmetric key
+ * is read
+ *
+ * The keys are derived and expanded only here, into the model context. A thread that needs a
+ * crypto context takes one left by an ended thread or, if there isn't one, it copies the model,
+ * so the threads created by fuse when the load grows don't derive the keys again
+ *
+ * @param ctx pubcfs_context that have all the current context
+ *
+ * @return 0 or -1 if error
+ */
+int pubcfs_initCryptoPool(pubcfs_context* ctx){
+	pubcfs_cryptoPool* pool;
+
+	pool = &(ctx->cryptoPool);
+	pool->free = NULL;
+	pool->model = pubcfs_deriveCryptoCtx(ctx);
+	if(pool->model == NULL) return -1;
+	pthread_mutex_init(&(pool->lock), NULL);
+
+	/* We create the key for the crypto context and when the thread need it the get function take
+	 * it and assign the context to the thread specific data pointed by ctx->cryptCtxKey */
+	pthread_key_create(&(ctx->cryptCtxKey), pubcfs_destroyCryptCtx);
+
+	return 0;
+}
+
+/** Free the pool of the crypto contexts, the threads that used them must be ended */
+void pubcfs_disposeCryptoPool(pubcfs_context* ctx){
+	pubcfs_cryptoPool* pool;
+	pubcfs_cryptoCtx* cctx;
 
-	cctx->en = en;
-	cctx->de = de;
+	pool = &(ctx->cryptoPool);
+	pthread_key_delete(ctx->cryptCtxKey);
+	while(pool->free != NULL){
+		cctx = pool->free;
+		pool->free = cctx->next;
+		pubcfs_freeCryptoCtx(cctx);
+	}
+	pubcfs_freeCryptoCtx(pool->model);
+	pool->model = NULL;
+	pthread_mutex_destroy(&(pool->lock));
+}
+
+/** Take a crypto context from the pool, this function should be call only by the
+ * pubcfs_getCryptoCtx function because a context can be used by a thread at a time
+ *
+ * @param ctx pubcfs_context that have all the current context
+ *
+ * @return the crypto context or NULL if error, you cannot deallocate it
+ */
+pubcfs_cryptoCtx* pubcfs_createCryptoCtx(pubcfs_context* ctx){
+	pubcfs_cryptoPool* pool;
+	pubcfs_cryptoCtx *cctx, *model;
+	bool copied;
+
+	pool = &(ctx->cryptoPool);
+	pthread_mutex_lock(&(pool->lock));
+	cctx = pool->free;
+	if(cctx != NULL){
+		pool->free = cctx->next;
+		pthread_mutex_unlock(&(pool->lock));
+		return cctx;
+	}
+
+	//the copies have the keys already expanded, the model is never used for encrypting
+	model = pool->model;
+	cctx = (pubcfs_cryptoCtx*)malloc(sizeof(pubcfs_cryptoCtx));
+	if(cctx != NULL){
+		EVP_CIPHER_CTX_init(&(cctx->en));
+		EVP_CIPHER_CTX_init(&(cctx->de));
+		EVP_CIPHER_CTX_init(&(cctx->ecb));
+		copied = EVP_CIPHER_CTX_copy(&(cctx->en), &(model->en))
+				 && EVP_CIPHER_CTX_copy(&(cctx->de), &(model->de))
+				 && EVP_CIPHER_CTX_copy(&(cctx->ecb), &(model->ecb));
+		cctx->blockCipher = model->blockCipher;
+		if(cctx->blockCipher){
+			EVP_CIPHER_CTX_init(&(cctx->blockEn));
+			EVP_CIPHER_CTX_init(&(cctx->blockDe));
+			copied = copied && EVP_CIPHER_CTX_copy(&(cctx->blockEn), &(model->blockEn))
+					 && EVP_CIPHER_CTX_copy(&(cctx->blockDe), &(model->blockDe));
+		}
+		memcpy(cctx->cfb8Iv, model->cfb8Iv, 16);
+		cctx->pool = pool;
+
+		if(!copied){
+			pubcfs_freeCryptoCtx(cctx);
+			cctx = NULL;
+		}
+	}
+	pthread_mutex_unlock(&(pool->lock));
 
 	return cctx;
 }
 
-/** Destroy the crypto context, see 'pthread_key_create'
+/** Return the crypto context of an ended thread to its pool, see 'pthread_key_create'
  */
-void pubcfs_destroyCryptCtx(void* cctx){
-	free(cctx);
-	//TODO: altro?
+void pubcfs_destroyCryptCtx(void* cryptCtx){
+	pubcfs_cryptoCtx* cctx;
+	pubcfs_cryptoPool* pool;
+
+	cctx = (pubcfs_cryptoCtx*)cryptCtx;
+	pool = cctx->pool;
+
+	pthread_mutex_lock(&(pool->lock));
+	cctx->next = pool->free;
+	pool->free = cctx;
+	pthread_mutex_unlock(&(pool->lock));
 }
 
 /** A generic function to encrypt data, for the cfb mode the size of the encrypted text is the same
@@ -335,6 +855,152 @@ void pubcfs_decrypt(EVP_CIPHER_CTX *de, uchar* cipherText, uchar* plainText, siz
 	EVP_DecryptFinal_ex(de, plainText + p_len, &f_len);
 }
 
+/** Decrypt data encrypted with cfb8, like pubcfs_decrypt with cctx->de but faster and from any
+ * point of the cipher text
+ *
+ * The byte i of the plain text is the byte i of the cipher text xor the first byte of the aes of
+ * the 16 bytes before it in iv + cipher text. All these bytes are already known, so the aes of
+ * PUBCFS_CFB8_BATCH bytes is done with a single ecb call on consecutive windows of the cipher text.
+ * OpenSSL encrypts many ecb blocks at the same time with AES-NI, so the decryption doesn't wait
+ * the latency of every aes like the byte by byte cfb8. Only the decryption can do it, the
+ * encryption needs the result of the previous byte.
+ *
+ * @param cctx pubcfs_cryptoCtx that have the crypto context
+ * @param prev the 16 bytes of cipher text before cipherText, NULL if cipherText is the start of the
+ * cipher
+ * @param cipherText the data to decrypt
+ * @param plainText the buffer that contain the decrypted data, it can be the same of cipherText or
+ * start before it
+ * @param size the size of the plain/cipher text
+ */
+void pubcfs_decryptCfb8(pubcfs_cryptoCtx* cctx, const uchar* prev, uchar* cipherText,
+						uchar* plainText, size_t size)
+{
+	uchar window[16 + PUBCFS_CFB8_BATCH]; //the 16 cipher bytes before the batch and the batch
+	uchar regs[16 * PUBCFS_CFB8_BATCH];
+	uchar keys[16 * PUBCFS_CFB8_BATCH];
+	size_t i, j, n;
+	int k_len;
+
+	memcpy(window, (prev != NULL) ? prev : cctx->cfb8Iv, 16);
+	for(i = 0; i < size; i += n){
+		n = (size - i < PUBCFS_CFB8_BATCH) ? size - i : PUBCFS_CFB8_BATCH;
+
+		//the cipher text is copied before writing the plain text, that can overwrite it
+		memcpy(window + 16, cipherText + i, n);
+		for(j = 0; j < n; j++) memcpy(regs + 16 * j, window + j, 16);
+
+		EVP_EncryptUpdate(&(cctx->ecb), keys, &k_len, regs, 16 * n);
+		for(j = 0; j < n; j++) plainText[i + j] = window[16 + j] ^ keys[16 * j];
+
+		memmove(window, window + n, 16);
+	}
+}
+
+/** Encrypt data with cfb8 from any point of the cipher text, the encryption of a part of a block
+ * that starts after the unchanged bytes. Unlike the decryption every byte needs the result of the
+ * previous one, so it is done by OpenSSL
+ *
+ * @param cctx pubcfs_cryptoCtx that have the crypto context
+ * @param prev the 16 bytes of cipher text before plainText
+ * @param plainText the data to encrypt
+ * @param cipherText the buffer that contain the encrypted data (it must be allocated before)
+ * @param size the size of the plain/cipher text
+ */
+void pubcfs_encryptCfb8(pubcfs_cryptoCtx* cctx, const uchar* prev, uchar* plainText,
+						uchar* cipherText, size_t size)
+{
+	int c_len;
+
+	EVP_EncryptInit_ex(&(cctx->en), NULL, NULL, NULL, prev);
+	EVP_EncryptUpdate(&(cctx->en), cipherText, &c_len, plainText, size);
+
+	//the iv replaces the one of the context, pubcfs_encrypt must start again from the right one
+	EVP_EncryptInit_ex(&(cctx->en), NULL, NULL, NULL, cctx->cfb8Iv);
+}
+
+/** Returns the cipher mode of a name of the configuration
+ *
+ * There is no ctr mode: with a key for all the folder and the block number as counter, the
+ * same block of every file would be encrypted with the same keystream.
+ *
+ * @param name "cfb8" or "xts"
+ *
+ * @return PUBCFS_CIPHER_* or -1 if the name is unknown
+ */
+int pubcfs_getCipher(const char* name){
+	if(strcmp(name, "cfb8") == 0) return PUBCFS_CIPHER_CFB8;
+	if(strcmp(name, "xts") == 0) return PUBCFS_CIPHER_XTS;
+	return -1;
+}
+
+/** Returns true if a block is encrypted with cfb8. The xts mode needs at least an aes block, the
+ * last block of a file shorter than 16 bytes uses cfb8 also in the xts folders */
+private bool pubcfs_isCfb8Block(pubcfs_context* ctx, size_t size){
+	return ctx->cipher == PUBCFS_CIPHER_CFB8 || (ctx->cipher == PUBCFS_CIPHER_XTS && size < 16);
+}
+
+/** Build the tweak of a block for xts, it is the number of the data unit (little endian, like
+ * IEEE P1619) */
+private void pubcfs_blockIv(ulong block, uchar* iv){
+	int i;
+
+	memset(iv, 0, 16);
+	for(i = 0; i < 8; i++) iv[i] = (block >> (8 * i)) & 0xFF;
+}
+
+/** Encrypt a block of a file with the cipher mode of the folder, the size of the encrypted block
+ * is the same of the plain block
+ *
+ * @param ctx pubcfs_context that have all the current context
+ * @param cctx pubcfs_cryptoCtx that have the crypto context
+ * @param block the number of the block in its file, it is the tweak of xts
+ * @param plainText the data to encrypt
+ * @param cipherText the buffer that contain the encrypted data (it must be allocated before)
+ * @param size the size of the plain/cipher text, at most ctx->blockSize
+ */
+void pubcfs_encryptBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, ulong block,
+						 uchar* plainText, uchar* cipherText, size_t size)
+{
+	uchar iv[16];
+	int c_len;
+
+	if(pubcfs_isCfb8Block(ctx, size)){
+		pubcfs_encrypt(&(cctx->en), plainText, cipherText, size);
+		return;
+	}
+
+	//with a new tweak xts starts a new data unit
+	pubcfs_blockIv(block, iv);
+	EVP_EncryptInit_ex(&(cctx->blockEn), NULL, NULL, NULL, iv);
+	EVP_EncryptUpdate(&(cctx->blockEn), cipherText, &c_len, plainText, size);
+}
+
+/** Decrypt a block of a file with the cipher mode of the folder, see pubcfs_encryptBlock
+ *
+ * @param ctx pubcfs_context that have all the current context
+ * @param cctx pubcfs_cryptoCtx that have the crypto context
+ * @param block the number of the block in its file, it is the tweak of xts
+ * @param cipherText the data to decrypt
+ * @param plainText the buffer that contain the decrypted data (it must be allocated before)
+ * @param size the size of the plain/cipher text, at most ctx->blockSize
+ */
+void pubcfs_decryptBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, ulong block,
+						 uchar* cipherText, uchar* plainText, size_t size)
+{
+	uchar iv[16];
+	int p_len;
+
+	if(pubcfs_isCfb8Block(ctx, size)){
+		pubcfs_decryptCfb8(cctx, NULL, cipherText, plainText, size);
+		return;
+	}
+
+	pubcfs_blockIv(block, iv);
+	EVP_DecryptInit_ex(&(cctx->blockDe), NULL, NULL, NULL, iv);
+	EVP_DecryptUpdate(&(cctx->blockDe), plainText, &p_len, cipherText, size);
+}
+
 /** Initialize the RSA functions */
 void pubcfs_initRSAModule(){
 	OpenSSL_add_all_algorithms();
@@ -418,6 +1084,36 @@ int pubcfs_checkCreateConfigFolders(char* rootPath){
 		return err;
 }
 
+/** Lock a crypted folder, pubcfs holds the lock while the folder is mounted and pubcfs-config
+ * while it converts the files to another block size. The lock is on the configuration folder and
+ * it is released when the returned descriptor (and its copies after a fork) is closed
+ *
+ * @return the descriptor, or -1 (errno is EWOULDBLOCK if another process holds the lock)
+ */
+int pubcfs_lockFolder(const char* rootPath){
+	char* path;
+	int fd, err;
+
+	path = (char*)malloc(strlen(rootPath) + strlen(PUBCFS_CONFIG_FOLDER) + 2);
+	if(path == NULL){
+		errno = ENOMEM;
+		return -1;
+	}
+	sprintf(path, "%s/%s", rootPath, PUBCFS_CONFIG_FOLDER);
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(path);
+	if(fd < 0) return -1;
+
+	if(flock(fd, LOCK_EX | LOCK_NB) != 0){
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
 /** Read the simmetric key decrypting the encrypted key of an user
  *
  * return PUBCFS_ERR_GENERIC on a generic error (for example a parameter is null)
@@ -665,6 +1361,67 @@ int pubcfs_initPubcfsFolder(RSA* pubKey, char* rootPath, char* userName){
 		err = PUBCFS_ERR_ENOMEM;
 		goto ret3;
 	}
+	ris = mConfig_add(c, "cachesize", PUBCFS_CONFIG_DEFAULT_CACHESIZE);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "namecache", PUBCFS_CONFIG_DEFAULT_NAMECACHE);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "readahead", PUBCFS_CONFIG_DEFAULT_READAHEAD);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "fadvise", PUBCFS_CONFIG_DEFAULT_FADVISE);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "workers", PUBCFS_CONFIG_DEFAULT_WORKERS);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "dirtylimit", PUBCFS_CONFIG_DEFAULT_DIRTYLIMIT);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "cryptoworkers", PUBCFS_CONFIG_DEFAULT_CRYPTOWORKERS);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "parallelcrypt", PUBCFS_CONFIG_DEFAULT_PARALLELCRYPT);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "ioengine", PUBCFS_CONFIG_DEFAULT_IOENGINE);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "kernelcache", PUBCFS_CONFIG_DEFAULT_KERNELCACHE);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	ris = mConfig_add(c, "writebackcache", PUBCFS_CONFIG_DEFAULT_WRITEBACKCACHE);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	//the new folders use a faster cipher, the folders without this key remain cfb8
+	ris = mConfig_add(c, "cipher", PUBCFS_CONFIG_NEW_CIPHER);
+	if(ris == MCONFIG_EADD){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
 	ris = mConfig_saveConfig(c, configFilePath);
 	if(ris == MCONFIG_EFILE){
 		err = PUBCFS_ERR_WRITEERROR;
@@ -17,8 +17,14 @@
 	#include <unistd.h>
 	#include <pthread.h>
 	#include <sys/types.h>
+	#include <sys/stat.h>
 	#include <dirent.h>
+	#include <fcntl.h>
 	#include <time.h>
+	#include <sys/ioctl.h>
+	#include <linux/fs.h>
+	#include <limits.h>
+	#include <sys/file.h>
 
 	#include <openssl/evp.h>
 	#include <openssl/aes.h>
@@ -27,9 +33,12 @@
 	#include <openssl/pem.h>
 
 	#include <util.h>
-	#include <fuse.h>
 	#include <mConfig/mConfig.h>
 	#include <base64/base64.h>
+	#include <blockCache/blockCache.h>
+	#include <nameCache/nameCache.h>
+	#include <workQueue/workQueue.h>
+	#include <ioRing/ioRing.h>
 
 	#define PUBCFS_CONFIG_FOLDER ".pubcfs"
 	#define PUBCFS_CONFIG_PATH ".pubcfs/config"
@@ -39,8 +48,48 @@
 	#define PUBCFS_FILENAME_ENC_WITH_S "/enc_"
 	#define PUBCFS_FILENAME_ENC "enc_"
 	#define PUBCFS_FILENAME_ENC_SIZE 4
+	#define PUBCFS_NAME_SIZE (NAME_MAX + 1) //size of the buffers of the names in the backing folder
 
-	#define PUBCFS_CONFIG_DEFAULT_BLOCKSIZE "64"
+	#define PUBCFS_CONFIG_DEFAULT_BLOCKSIZE "4096"
+	#define PUBCFS_CONFIG_DEFAULT_CACHESIZE "16777216" //bytes of decrypted blocks, 0 disable it
+	#define PUBCFS_CONFIG_DEFAULT_NAMECACHE "1048576" //bytes of encrypted names, 0 disable it
+	#define PUBCFS_CONFIG_DEFAULT_READAHEAD "1048576" //max bytes read in advance, 0 disable it
+	#define PUBCFS_CONFIG_DEFAULT_FADVISE "1" //1 for advise the kernel of the read-ahead
+	#define PUBCFS_CONFIG_DEFAULT_WORKERS "2" //threads for the background jobs
+
+	#define PUBCFS_CONFIG_DEFAULT_DIRTYLIMIT "4194304" //max bytes of dirty blocks, 0 write through
+
+	#define PUBCFS_CONFIG_DEFAULT_CRYPTOWORKERS "-1" //threads for decrypting, -1 one for every cpu
+	#define PUBCFS_CONFIG_DEFAULT_PARALLELCRYPT "131072" //min bytes decrypted with more threads
+	#define PUBCFS_CONFIG_DEFAULT_IOENGINE "sync" //sync for pread and pwrite, uring for io_uring
+	#define PUBCFS_CONFIG_DEFAULT_KERNELCACHE "0" //seconds the kernel keeps names, attributes and
+												 //data of unchanged files, 0 disable it
+	#define PUBCFS_CONFIG_DEFAULT_WRITEBACKCACHE "0" //1 for letting the kernel cache the writes
+	#define PUBCFS_CONFIG_DEFAULT_CIPHER "cfb8" //cipher of the blocks of the folders without the key
+	#define PUBCFS_CONFIG_NEW_CIPHER "xts" //cipher mode of the blocks of the new folders
+
+	#define PUBCFS_IOENGINE_SYNC 0
+	#define PUBCFS_IOENGINE_URING 1
+
+	#define PUBCFS_CIPHER_CFB8 0 //a cipher operation for every byte, the format of the first folders
+	#define PUBCFS_CIPHER_XTS 1 //the block number is the tweak, it needs blocks of 16 bytes
+
+	#define PUBCFS_BLOCKSIZE_MIN 8
+	#define PUBCFS_BLOCKSIZE_MAX 1048576
+	#define PUBCFS_BLOCKSIZE_RECOMMENDED 4096 //smaller block sizes are slow, they need more syscalls
+
+	#define PUBCFS_RESIZE_JOURNAL_PATH ".pubcfs/resize" //exists during a block size conversion
+	#define PUBCFS_RESIZE_TMP_PREFIX ".pubcfs-resize-" //the converted files before the rename
+
+	#define PUBCFS_WORKQUEUE_MAXJOBS 64 //max waiting read-ahead jobs
+	#define PUBCFS_OPENFILES_BUCKETS 256 //buckets of the open files table
+	#define PUBCFS_INODES_MINBUCKETS 1024 //initial buckets of the inode table
+	#define PUBCFS_WRITEBACK_INTERVAL 5 //seconds between two background write-back
+	#define PUBCFS_IO_MAXSPAN 1048576 //max bytes read or written with a single pread or pwrite
+	#define PUBCFS_IORING_ENTRIES 64 //size of the submission queue of the io_uring rings
+	#define PUBCFS_CFB8_BATCH 256 //bytes decrypted with a single ecb call, see pubcfs_decryptCfb8
+	#define PUBCFS_SUFFIX_MIN 256 //a cfb8 block is written from the first changed byte if it is
+								  //at least at this offset, see pubcfs_writeBackLocked
 
 	#define PUBCFS_ERR_GENERIC 				-1	//Generic error
 	#define PUBCFS_ERR_NOUSER 				-2	//When the user is not in the keys folder
@@ -52,16 +101,80 @@
 	#define PUBCFS_ERR_ENOMEM	 			-8	//When there is impossible to add the user
 	#define PUBCFS_ERR_BADCONFIGFOLDER		-9	//When the config folder not exists
 	#define PUBCFS_ERR_ONLYONEUSR			-10 //When there is only one user and we can't remove it
+	#define PUBCFS_ERR_BADBLOCKSIZE			-11 //When the block size is out of the valid range
+	#define PUBCFS_ERR_RESIZEPENDING		-12 //When another block size conversion was interrupted
+	#define PUBCFS_ERR_MOUNTED				-13 //When the folder is mounted or locked by another process
 	#define PUBCFS_NOERR 					 0	//All OK!!
 
 	#define PUBCFS_SIMMKEY_SIZE 64
 
 
-	typedef struct {
-		EVP_CIPHER_CTX en;
+	typedef struct str_pubcfs_cryptoCtx{
+		EVP_CIPHER_CTX en; //cfb8, for the names and the blocks of the cfb8 folders
 		EVP_CIPHER_CTX de;
+		EVP_CIPHER_CTX blockEn; //the cipher of the blocks if it is not cfb8
+		EVP_CIPHER_CTX blockDe;
+		EVP_CIPHER_CTX ecb; //aes of the cfb8 key, for decrypting many bytes at the same time
+		uchar cfb8Iv[16];
+		bool blockCipher; //blockEn and blockDe are used
+		struct str_pubcfs_cryptoPool* pool; //the context returns here when its thread ends
+		struct str_pubcfs_cryptoCtx* next; //next free context of the pool
 	} pubcfs_cryptoCtx;
 
+	/** The crypto contexts not used by a thread, see pubcfs_initCryptoPool */
+	typedef struct str_pubcfs_cryptoPool{
+		pthread_mutex_t lock; //protect free
+		pubcfs_cryptoCtx* free;
+		pubcfs_cryptoCtx* model; //the keys are derived only for it, the new contexts are copies
+	} pubcfs_cryptoPool;
+
+	/** A block changed by a write and not yet written to the file, it contains plain data */
+	typedef struct str_pubcfs_dirtyBlock{
+		ulong block;
+		size_t size; //valid bytes of data, it is less than blocksize only for the last block
+		size_t from; //the bytes before it are unchanged and encrypted in the file, see
+					 //pubcfs_markChanged
+		struct str_pubcfs_dirtyBlock* next;
+		ubyte data[];
+	} pubcfs_dirtyBlock;
+
+	/** The state of a file shared by all its handles, the files are identified by device and
+	 * inode so the hard links share it too */
+	typedef struct str_pubcfs_openFile{
+		dev_t dev;
+		ino_t ino;
+		uint refs; //protected by the lock of the open files table
+		struct str_pubcfs_openFile* next;
+		pthread_mutex_t lock; //protect all the next fields
+		int fd; //writable descriptor used for the write-back, -1 before the first write
+		off_t size; //size of the file including the dirty blocks
+		pubcfs_dirtyBlock** dirty; //hash table of the dirty blocks
+		size_t dirtyBuckets;
+		size_t dirtyCount;
+		int error; //error of a background write-back, returned by the next flush or fsync
+	} pubcfs_openFile;
+
+	/** A file or directory known by the kernel, its address is the nodeid given to the kernel
+	 * and the backing file is reached with the *at calls on fd, so the operations never encode
+	 * the full path */
+	typedef struct str_pubcfs_inode{
+		dev_t dev; //device and inode of the backing file
+		ino_t ino;
+		int fd; //O_PATH descriptor of the backing file
+		ulong nlookup; //lookups not yet forgotten by the kernel, protected by the inode table lock
+		struct str_pubcfs_inode* next;
+		bool cached; //the kernel can have data of the file in its cache, protected by the same lock
+		struct timespec cacheMtime; //mtime and size of the backing file when the kernel cached it
+		off_t cacheSize;
+	} pubcfs_inode;
+
+	/** Blocks encrypted or decrypted by the crypto threads, see pubcfs_cryptStart */
+	typedef struct {
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+		size_t pending; //parts not yet done
+	} pubcfs_cryptBatch;
+
 	typedef struct {
 	    char *rootPath;
 	    char *privateKeyPath;
@@ -69,24 +182,140 @@
 	    ubyte *key;
 	    size_t keyLen;
 	    size_t blockSize;
+	    int cipher; //cipher mode of the blocks, PUBCFS_CIPHER_*
+	    size_t cacheSize;
+	    blockCache_t* blockCache;
+	    size_t nameCacheSize;
+	    nameCache_t* nameCache;
+	    size_t readAhead;
+	    bool fadvise;
+	    int workers;
+	    workQueue_t* workQueue;
+	    size_t dirtyLimit;
+	    size_t dirtyBytes; //memory used by the dirty blocks of all the files
+	    pthread_mutex_t openFilesLock; //protect the open files table and dirtyBytes
+	    pubcfs_openFile* openFiles[PUBCFS_OPENFILES_BUCKETS];
+	    size_t openFilesCount;
+	    pthread_t flusher;
+	    pthread_cond_t flusherCond;
+	    bool flusherStarted;
+	    bool flusherStop;
+	    int cryptoWorkers;
+	    size_t parallelCrypt;
+	    workQueue_t* cryptoQueue;
+	    int ioEngine;
+	    pthread_key_t ioRingKey;
+	    pubcfs_inode rootInode; //the root folder, it is never forgotten
+	    pthread_mutex_t inodesLock; //protect the inode table
+	    pubcfs_inode** inodes; //hash table of the other inodes known by the kernel
+	    size_t inodesBuckets;
+	    size_t inodesCount;
+	    long kernelCache; //seconds of the kernel cache of unchanged files, 0 if it is disabled
+	    bool writebackCache; //the kernel caches the writes and owns size and mtime of the files
+	    double attrTimeout; //seconds the kernel keeps the attributes and the names
+	    double entryTimeout;
+	    struct fuse_session* session; //used for the notifications to the kernel
+	    pubcfs_cryptoPool cryptoPool;
 	    pthread_key_t cryptCtxKey;
 	} pubcfs_context;
 
-	char* pubcfs_encodePath(pubcfs_context* ctx, const char *path, bool addRootPath);
-	char* pubcfs_decryptName(pubcfs_context* ctx, const char *name);
+	typedef struct {
+		int fd;
+		dev_t dev; //device and inode of the backing file, they are the key of the block cache
+		ino_t ino;
+		pubcfs_openFile* of; //NULL for the handles of the read-ahead jobs
+		pthread_mutex_t lock; //protect the read-ahead state
+		off_t raNext; //offset of the next read if the access is sequential
+		ulong raWindow; //blocks to read in advance, 0 if the access is not sequential
+		ulong raEnd; //first block after the blocks already read in advance
+		bool written; //the file was changed with this handle
+	} pubcfs_fileHandle;
+
+	/** An open directory, the kernel reads it in more calls that start at the offset of the entry
+	 * after the last one returned */
+	typedef struct {
+		DIR* dp;
+		off_t offset; //offset of the next entry of dp
+		struct dirent* entry; //entry read but not returned because the buffer was full, or NULL
+	} pubcfs_dirHandle;
 
-	int pubcfs_readBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, int fp,
+	int pubcfs_encodePath(pubcfs_context* ctx, const char *path, char* e_path);
+	int pubcfs_decodePath(pubcfs_context* ctx, char *e_path, char* path);
+	int pubcfs_decryptName(pubcfs_context* ctx, const char *name, char* de_name, size_t size);
+	int pubcfs_encryptName(pubcfs_context* ctx, const char *name, char* e_name, size_t size);
+
+	int pubcfs_initInodes(pubcfs_context* ctx);
+	void pubcfs_disposeInodes(pubcfs_context* ctx);
+	pubcfs_inode* pubcfs_lookupInode(pubcfs_context* ctx, pubcfs_inode* parent, const char* e_name,
+									 struct stat* st);
+	void pubcfs_forgetInode(pubcfs_context* ctx, pubcfs_inode* inode, ulong nlookup);
+	bool pubcfs_checkInodeCache(pubcfs_context* ctx, pubcfs_inode* inode, const struct stat* st);
+	void pubcfs_setInodeCache(pubcfs_context* ctx, pubcfs_inode* inode, const struct stat* st);
+
+	int pubcfs_readBlocks(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+						  ulong first, size_t count, ubyte* de_buf, int* sizes);
+	int pubcfs_readBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
 						 ulong block, ubyte* de_buf);
-	int pubcfs_writeBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, int fp,
+	int pubcfs_writeBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
 						  ulong block, ubyte* de_buf, size_t size);
 
-	pubcfs_context* pubcfs_getCtx();
+	pubcfs_fileHandle* pubcfs_createFileHandle(pubcfs_context* ctx, int fd);
+	void pubcfs_destroyFileHandle(pubcfs_context* ctx, pubcfs_fileHandle* fh);
+	void pubcfs_invalidateBlocks(pubcfs_context* ctx, dev_t dev, ino_t ino, ulong first, ulong last);
+	void pubcfs_invalidateRemoved(pubcfs_context* ctx, int fd);
+	void pubcfs_readAhead(pubcfs_context* ctx, pubcfs_fileHandle* fh, off_t offset, size_t count);
+
+	void pubcfs_initCryptoWorkers(pubcfs_context* ctx);
+	void pubcfs_disposeCryptoWorkers(pubcfs_context* ctx);
+	void pubcfs_cryptBlocks(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, bool encrypt, ulong block,
+							ubyte* in, ubyte* out, size_t len);
+	void pubcfs_cryptStart(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_cryptBatch* batch,
+						   bool encrypt, ulong block, ubyte* in, ubyte* out, size_t len);
+	void pubcfs_cryptWait(pubcfs_cryptBatch* batch);
+	bool pubcfs_isHole(const ubyte* buf, size_t len, size_t blockSize);
+
+	void pubcfs_initOpenFiles(pubcfs_context* ctx);
+	void pubcfs_disposeOpenFiles(pubcfs_context* ctx);
+	pubcfs_openFile* pubcfs_getOpenFile(pubcfs_context* ctx, dev_t dev, ino_t ino, off_t size,
+										bool create);
+	void pubcfs_putOpenFile(pubcfs_context* ctx, pubcfs_openFile* of);
+	void pubcfs_updateStat(pubcfs_context* ctx, struct stat* st);
+	int pubcfs_readFileBuf(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+						   ubyte** bufp, size_t count, off_t offset);
+	int pubcfs_readFile(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+						ubyte* buf, size_t count, off_t offset);
+	pubcfs_dirtyBlock* pubcfs_getDirtyBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx,
+											pubcfs_fileHandle* fh, ulong block, bool load);
+	void pubcfs_markChanged(pubcfs_dirtyBlock* db, size_t offset);
+	int pubcfs_writeBack(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_openFile* of);
+	int pubcfs_writeBackLocked(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_openFile* of);
+	int pubcfs_setFileSize(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, int fd, off_t newSize);
+	int pubcfs_allocate(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh, int mode,
+						off_t offset, off_t len);
+	ssize_t pubcfs_copyRange(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fhIn,
+							 off_t offIn, pubcfs_fileHandle* fhOut, off_t offOut, size_t len);
+	bool pubcfs_dirtyLimitReached(pubcfs_context* ctx);
+
 	pubcfs_cryptoCtx* pubcfs_getCryptoCtx(pubcfs_context* st);
+	int pubcfs_initCryptoPool(pubcfs_context* ctx);
+	void pubcfs_disposeCryptoPool(pubcfs_context* ctx);
 	pubcfs_cryptoCtx* pubcfs_createCryptoCtx(pubcfs_context* st);
 	void pubcfs_destroyCryptCtx(void* cryptCtx);
+	void pubcfs_initIoEngine(pubcfs_context* ctx);
+	ioRing_t* pubcfs_getIoRing(pubcfs_context* ctx);
+	void pubcfs_destroyIoRing(void* r);
 
 	void pubcfs_encrypt(EVP_CIPHER_CTX *e, uchar* plainText, uchar* cipherText, size_t size);
 	void pubcfs_decrypt(EVP_CIPHER_CTX *de, uchar* cipherText, uchar* plainText, size_t size);
+	void pubcfs_decryptCfb8(pubcfs_cryptoCtx* cctx, const uchar* prev, uchar* cipherText,
+							uchar* plainText, size_t size);
+	void pubcfs_encryptCfb8(pubcfs_cryptoCtx* cctx, const uchar* prev, uchar* plainText,
+							uchar* cipherText, size_t size);
+	int pubcfs_getCipher(const char* name);
+	void pubcfs_encryptBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, ulong block,
+							 uchar* plainText, uchar* cipherText, size_t size);
+	void pubcfs_decryptBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, ulong block,
+							 uchar* cipherText, uchar* plainText, size_t size);
 
 	void pubcfs_initRSAModule();
 	RSA* pubcfs_readPublicKey(const char *filename);
@@ -103,5 +332,8 @@
 	int pubcfs_listAllUser(FILE* fdOut, char* rootPath);
 	int pubcfs_countUsers(char* rootPath, uint* userCount);
 	int pubcfs_deleteUser(char* rootPath, char* userName);
+	int pubcfs_changeBlockSize(char* rootPath, char* userName, RSA* privKey, size_t newBlockSize,
+							   int threadCount, FILE* fdOut);
+	int pubcfs_lockFolder(const char* rootPath);
 
 #endif
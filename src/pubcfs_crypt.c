@@ -0,0 +1,220 @@
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+/**
+ * @file pubcfs_crypt.c
+ * @brief Encryption and decryption of many blocks with more threads
+ *
+ * Every block is encrypted from the start of the cipher, with cfb8, or with its block number as
+ * tweak, with xts, so the blocks are independent and a buffer of consecutive blocks can be
+ * split in parts that are decrypted at the same time if every part knows its first block. The
+ * parts are executed by the threads of ctx->cryptoQueue, a work queue different from the one of
+ * the read-ahead because the read-ahead jobs wait the crypto jobs. The buffers smaller than
+ * ctx->parallelCrypt are decrypted by the calling thread, for them the synchronization costs more
+ * than the decryption.
+ *
+ * The write-back uses pubcfs_cryptStart and pubcfs_cryptWait for encrypting a run of blocks while
+ * it writes the previous one.
+ *
+ * An entire block of encrypted zeros is a hole: it contains plain zeros and it is never given to
+ * the cipher. So the holes of the backing files are read as zeros and the write-back can punch a
+ * hole for a block of zeros. The last block of a file can be partial and it is always encrypted,
+ * for the entire blocks a real encrypted block of zeros has a probability of 2^-(8 * blocksize).
+ */
+
+#include <pubcfs.h>
+
+typedef struct {
+	pubcfs_context* ctx;
+	pubcfs_cryptBatch* batch;
+	bool encrypt;
+	ulong block;
+	ubyte* in;
+	ubyte* out;
+	size_t len;
+} pubcfs_cryptJob;
+
+/** Returns true if a block is a hole, that is an entire block of zeros
+ *
+ * @param len the bytes of the block
+ * @param blockSize the size of the entire blocks
+ */
+bool pubcfs_isHole(const ubyte* buf, size_t len, size_t blockSize){
+	return len == blockSize && buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0;
+}
+
+/** Encrypt or decrypt consecutive blocks with a single thread, only the last one can be partial.
+ * The holes remain zeros in both directions
+ *
+ * @param block the number of the first block in its file
+ */
+private void pubcfs_cryptSerial(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, bool encrypt,
+								ulong block, ubyte* in, ubyte* out, size_t len){
+	size_t i, blockLen;
+
+	for(i = 0; i < len; i += blockLen, block++){
+		blockLen = (len - i < ctx->blockSize) ? len - i : ctx->blockSize;
+		if(pubcfs_isHole(in + i, blockLen, ctx->blockSize)){
+			if(out != in) memset(out + i, 0, blockLen);
+		}else if(encrypt){
+			pubcfs_encryptBlock(ctx, cctx, block, in + i, out + i, blockLen);
+		}else{
+			pubcfs_decryptBlock(ctx, cctx, block, in + i, out + i, blockLen);
+		}
+	}
+}
+
+/** Execute a part, every thread of the queue uses its own crypto context */
+private void pubcfs_cryptWorker(void* arg){
+	pubcfs_cryptJob* job;
+	pubcfs_cryptBatch* batch;
+
+	job = (pubcfs_cryptJob*)arg;
+	batch = job->batch;
+
+	pubcfs_cryptSerial(job->ctx, pubcfs_getCryptoCtx(job->ctx), job->encrypt, job->block, job->in,
+					   job->out, job->len);
+
+	pthread_mutex_lock(&(batch->lock));
+	if(--(batch->pending) == 0) pthread_cond_signal(&(batch->cond));
+	pthread_mutex_unlock(&(batch->lock));
+
+	free(job);
+}
+
+/** Start the crypto threads, the number of threads is ctx->cryptoWorkers. With 0 threads all the
+ * blocks are decrypted by the threads that read them */
+void pubcfs_initCryptoWorkers(pubcfs_context* ctx){
+	ctx->cryptoQueue = NULL;
+	if(ctx->cryptoWorkers > 0) ctx->cryptoQueue = workQueue_new(ctx->cryptoWorkers, 0);
+}
+
+/** Stop the crypto threads, nobody must use them */
+void pubcfs_disposeCryptoWorkers(pubcfs_context* ctx){
+	workQueue_dispose(ctx->cryptoQueue);
+	ctx->cryptoQueue = NULL;
+}
+
+/** Split consecutive blocks in parts with entire blocks and push them to the crypto threads, a
+ * part that can't be pushed is executed by the calling thread
+ *
+ * @param parts the number of parts
+ * @param skipFirst true if the first part is not pushed because the caller will execute it
+ *
+ * @return the size of the first part
+ */
+private size_t pubcfs_cryptPush(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx,
+								pubcfs_cryptBatch* batch, bool encrypt, ulong block, ubyte* in,
+								ubyte* out, size_t len, size_t parts, bool skipFirst){
+	pubcfs_cryptJob* job;
+	size_t blocks, partLen, start, n;
+
+	blocks = (len + ctx->blockSize - 1) / ctx->blockSize;
+	if(parts > blocks) parts = blocks;
+	partLen = ((blocks + parts - 1) / parts) * ctx->blockSize;
+
+	for(start = skipFirst ? partLen : 0; start < len; start += partLen){
+		n = (len - start < partLen) ? len - start : partLen;
+
+		job = (pubcfs_cryptJob*)malloc(sizeof(pubcfs_cryptJob));
+		if(job != NULL){
+			job->ctx = ctx;
+			job->batch = batch;
+			job->encrypt = encrypt;
+			job->block = block + start / ctx->blockSize;
+			job->in = in + start;
+			job->out = out + start;
+			job->len = n;
+
+			pthread_mutex_lock(&(batch->lock));
+			batch->pending++;
+			pthread_mutex_unlock(&(batch->lock));
+			if(workQueue_push(ctx->cryptoQueue, pubcfs_cryptWorker, job)) continue;
+
+			pthread_mutex_lock(&(batch->lock));
+			batch->pending--;
+			pthread_mutex_unlock(&(batch->lock));
+			free(job);
+		}
+		pubcfs_cryptSerial(ctx, cctx, encrypt, block + start / ctx->blockSize, in + start, out + start,
+						   n);
+	}
+
+	return partLen;
+}
+
+/** Start to encrypt or decrypt consecutive blocks with the crypto threads, the calling thread can
+ * do something else until pubcfs_cryptWait. If the blocks are less than ctx->parallelCrypt bytes
+ * they are done before returning
+ *
+ * @param cctx the crypto context of the calling thread
+ * @param batch it will contain the state of the parts, it must live until pubcfs_cryptWait
+ * @param encrypt true for encrypt, false for decrypt
+ * @param block the number of the first block in its file
+ * @param in the first block, every block starts blockSize bytes after the previous one
+ * @param out the buffer for the result, it can be the same of in
+ * @param len the total bytes, only the last block can be partial
+ */
+void pubcfs_cryptStart(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_cryptBatch* batch,
+					   bool encrypt, ulong block, ubyte* in, ubyte* out, size_t len){
+	pthread_mutex_init(&(batch->lock), NULL);
+	pthread_cond_init(&(batch->cond), NULL);
+	batch->pending = 0;
+
+	if(ctx->cryptoQueue == NULL || len < ctx->parallelCrypt || len == 0){
+		pubcfs_cryptSerial(ctx, cctx, encrypt, block, in, out, len);
+		return;
+	}
+
+	pubcfs_cryptPush(ctx, cctx, batch, encrypt, block, in, out, len, ctx->cryptoQueue->threadCount,
+					 false);
+}
+
+/** Wait the end of the blocks started with pubcfs_cryptStart */
+void pubcfs_cryptWait(pubcfs_cryptBatch* batch){
+	pthread_mutex_lock(&(batch->lock));
+	while(batch->pending > 0) pthread_cond_wait(&(batch->cond), &(batch->lock));
+	pthread_mutex_unlock(&(batch->lock));
+
+	pthread_cond_destroy(&(batch->cond));
+	pthread_mutex_destroy(&(batch->lock));
+}
+
+/** Encrypt or decrypt consecutive blocks, the blocks are split between the calling thread and the
+ * crypto threads if they are at least ctx->parallelCrypt bytes
+ *
+ * @param cctx the crypto context of the calling thread
+ * @param encrypt true for encrypt, false for decrypt
+ * @param block the number of the first block in its file
+ * @param in the first block, every block starts blockSize bytes after the previous one
+ * @param out the buffer for the result, it can be the same of in
+ * @param len the total bytes, only the last block can be partial
+ */
+void pubcfs_cryptBlocks(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, bool encrypt, ulong block,
+						ubyte* in, ubyte* out, size_t len){
+	pubcfs_cryptBatch batch;
+	size_t partLen;
+
+	if(ctx->cryptoQueue == NULL || len < ctx->parallelCrypt || len <= ctx->blockSize){
+		pubcfs_cryptSerial(ctx, cctx, encrypt, block, in, out, len);
+		return;
+	}
+
+	pthread_mutex_init(&(batch.lock), NULL);
+	pthread_cond_init(&(batch.cond), NULL);
+	batch.pending = 0;
+
+	//a part for every thread and one for the caller, that executes the first after the push
+	partLen = pubcfs_cryptPush(ctx, cctx, &batch, encrypt, block, in, out, len,
+							   ctx->cryptoQueue->threadCount + 1, true);
+	pubcfs_cryptSerial(ctx, cctx, encrypt, block, in, out, partLen);
+
+	pubcfs_cryptWait(&batch);
+}
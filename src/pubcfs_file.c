@@ -0,0 +1,1214 @@
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+/**
+ * @file pubcfs_file.c
+ * @brief Open files and write-back of the dirty blocks
+ *
+ * The writes don't go directly to the backing file: the changed blocks are kept decrypted in the
+ * open file (pubcfs_openFile, one for every inode in use) and the next writes to the same blocks
+ * change them in memory. The dirty blocks are encrypted and written in offset order, merging the
+ * consecutive ones in a single pwrite and encrypting the big runs with the crypto threads, when
+ * the file is flushed, synced, released or truncated, when the dirty blocks of all the files
+ * exceed ctx->dirtyLimit and every PUBCFS_WRITEBACK_INTERVAL seconds by the flusher thread.
+ *
+ * The reads look for the dirty blocks before reading the file, and getattr returns the size that
+ * the file will have after the write-back. In the cfb8 folders a read inside a block decrypts only
+ * the requested bytes (see pubcfs_readWindow).
+ *
+ * The dirty blocks of zeros are written as holes (see pubcfs_isHole) with a punch of the backing
+ * file, or with zeros if the file system can't do it. For the same reason fallocate allocates and
+ * punches the backing file directly (see pubcfs_allocate), without encrypting the zeros.
+ *
+ * The copies between files move the entire blocks as ciphertext (see pubcfs_copyRange).
+ */
+
+#include <pubcfs.h>
+
+private inline pubcfs_openFile** pubcfs_openFilesBucket(pubcfs_context* ctx, dev_t dev, ino_t ino){
+	return &(ctx->openFiles[((ulong)ino ^ ((ulong)dev << 7)) % PUBCFS_OPENFILES_BUCKETS]);
+}
+
+/** Add delta to the bytes used by the dirty blocks */
+private void pubcfs_addDirtyBytes(pubcfs_context* ctx, long delta){
+	pthread_mutex_lock(&(ctx->openFilesLock));
+	ctx->dirtyBytes += delta;
+	pthread_mutex_unlock(&(ctx->openFilesLock));
+}
+
+/** Returns true if the dirty blocks of all the files use more than ctx->dirtyLimit bytes, in this
+ * case the flusher thread is woken up */
+bool pubcfs_dirtyLimitReached(pubcfs_context* ctx){
+	bool reached;
+
+	pthread_mutex_lock(&(ctx->openFilesLock));
+	reached = ctx->dirtyBytes > ctx->dirtyLimit;
+	if(reached) pthread_cond_signal(&(ctx->flusherCond));
+	pthread_mutex_unlock(&(ctx->openFilesLock));
+
+	return reached;
+}
+
+/** The thread that periodically writes the dirty blocks of all the open files */
+private void* pubcfs_flusher(void* arg){
+	pubcfs_context* ctx;
+	pubcfs_cryptoCtx* cctx;
+	pubcfs_openFile **files, *of;
+	struct timespec deadline;
+	size_t i, count;
+
+	ctx = (pubcfs_context*)arg;
+	cctx = pubcfs_getCryptoCtx(ctx);
+
+	pthread_mutex_lock(&(ctx->openFilesLock));
+	while(!ctx->flusherStop){
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += PUBCFS_WRITEBACK_INTERVAL;
+		pthread_cond_timedwait(&(ctx->flusherCond), &(ctx->openFilesLock), &deadline);
+		if(ctx->flusherStop || ctx->dirtyBytes == 0) continue;
+
+		//take a reference to all the open files, then write them without the table lock
+		files = (pubcfs_openFile**)malloc(ctx->openFilesCount * sizeof(pubcfs_openFile*));
+		if(files == NULL) continue;
+		count = 0;
+		for(i = 0; i < PUBCFS_OPENFILES_BUCKETS; i++){
+			for(of = ctx->openFiles[i]; of != NULL; of = of->next){
+				of->refs++;
+				files[count++] = of;
+			}
+		}
+		pthread_mutex_unlock(&(ctx->openFilesLock));
+
+		for(i = 0; i < count; i++){
+			//on error the blocks remain dirty and the error is returned by the next flush
+			pthread_mutex_lock(&(files[i]->lock));
+			pubcfs_writeBackLocked(ctx, cctx, files[i]);
+			pthread_mutex_unlock(&(files[i]->lock));
+			pubcfs_putOpenFile(ctx, files[i]);
+		}
+		free(files);
+
+		pthread_mutex_lock(&(ctx->openFilesLock));
+	}
+	pthread_mutex_unlock(&(ctx->openFilesLock));
+
+	return NULL;
+}
+
+/** Initialize the table of the open files and start the flusher thread, it must be called before
+ * opening the files */
+void pubcfs_initOpenFiles(pubcfs_context* ctx){
+	pthread_mutex_init(&(ctx->openFilesLock), NULL);
+	pthread_cond_init(&(ctx->flusherCond), NULL);
+	memset(ctx->openFiles, 0, sizeof(ctx->openFiles));
+	ctx->openFilesCount = 0;
+	ctx->dirtyBytes = 0;
+	ctx->flusherStop = false;
+
+	//without the limit the writes go directly to the files and the flusher is useless
+	ctx->flusherStarted = (ctx->dirtyLimit > 0)
+						  && (pthread_create(&(ctx->flusher), NULL, pubcfs_flusher, ctx) == 0);
+}
+
+/** Stop the flusher thread, all the files must be already released */
+void pubcfs_disposeOpenFiles(pubcfs_context* ctx){
+	if(ctx->flusherStarted){
+		pthread_mutex_lock(&(ctx->openFilesLock));
+		ctx->flusherStop = true;
+		pthread_cond_signal(&(ctx->flusherCond));
+		pthread_mutex_unlock(&(ctx->openFilesLock));
+		pthread_join(ctx->flusher, NULL);
+		ctx->flusherStarted = false;
+	}
+	pthread_cond_destroy(&(ctx->flusherCond));
+	pthread_mutex_destroy(&(ctx->openFilesLock));
+}
+
+/** Get the open file of an inode and take a reference to it
+ *
+ * @param size the current size of the file, used only when the open file is created
+ * @param create if false and the file isn't open NULL is returned
+ *
+ * @return the open file that must be released with pubcfs_putOpenFile, or NULL on error
+ */
+pubcfs_openFile* pubcfs_getOpenFile(pubcfs_context* ctx, dev_t dev, ino_t ino, off_t size,
+									bool create){
+	pubcfs_openFile **bucket, *of;
+
+	bucket = pubcfs_openFilesBucket(ctx, dev, ino);
+
+	pthread_mutex_lock(&(ctx->openFilesLock));
+	for(of = *bucket; of != NULL; of = of->next){
+		if(of->ino == ino && of->dev == dev){
+			of->refs++;
+			pthread_mutex_unlock(&(ctx->openFilesLock));
+			return of;
+		}
+	}
+	if(!create){
+		pthread_mutex_unlock(&(ctx->openFilesLock));
+		return NULL;
+	}
+
+	of = (pubcfs_openFile*)malloc(sizeof(pubcfs_openFile));
+	if(of == NULL){
+		pthread_mutex_unlock(&(ctx->openFilesLock));
+		errno = ENOMEM;
+		return NULL;
+	}
+	of->dev = dev;
+	of->ino = ino;
+	of->refs = 1;
+	pthread_mutex_init(&(of->lock), NULL);
+	of->fd = -1;
+	of->size = size;
+	of->dirty = NULL;
+	of->dirtyBuckets = 0;
+	of->dirtyCount = 0;
+	of->error = 0;
+	of->next = *bucket;
+	*bucket = of;
+	ctx->openFilesCount++;
+	pthread_mutex_unlock(&(ctx->openFilesLock));
+
+	return of;
+}
+
+/** Release a reference taken with pubcfs_getOpenFile, the last one writes the dirty blocks and
+ * disposes the open file */
+void pubcfs_putOpenFile(pubcfs_context* ctx, pubcfs_openFile* of){
+	pubcfs_openFile** p;
+
+	pthread_mutex_lock(&(ctx->openFilesLock));
+	if(--(of->refs) > 0){
+		pthread_mutex_unlock(&(ctx->openFilesLock));
+		return;
+	}
+	p = pubcfs_openFilesBucket(ctx, of->dev, of->ino);
+	while(*p != of) p = &((*p)->next);
+	*p = of->next;
+	ctx->openFilesCount--;
+	pthread_mutex_unlock(&(ctx->openFilesLock));
+
+	//usually release already did it, the errors can't be returned anymore
+	if(of->dirtyCount > 0) pubcfs_writeBack(ctx, pubcfs_getCryptoCtx(ctx), of);
+
+	if(of->fd >= 0) close(of->fd);
+	pthread_mutex_destroy(&(of->lock));
+	free(of->dirty);
+	free(of);
+}
+
+/** If the file is open and has some dirty blocks change the size returned by stat with the size
+ * that the file will have after the write-back */
+void pubcfs_updateStat(pubcfs_context* ctx, struct stat* st){
+	pubcfs_openFile* of;
+
+	if(!S_ISREG(st->st_mode)) return;
+
+	of = pubcfs_getOpenFile(ctx, st->st_dev, st->st_ino, 0, false);
+	if(of == NULL) return;
+
+	pthread_mutex_lock(&(of->lock));
+	if(of->dirtyCount > 0) st->st_size = of->size;
+	pthread_mutex_unlock(&(of->lock));
+
+	pubcfs_putOpenFile(ctx, of);
+}
+
+/** Find a dirty block, the lock of the open file must be held */
+private pubcfs_dirtyBlock** pubcfs_findDirtyBlock(pubcfs_openFile* of, ulong block){
+	pubcfs_dirtyBlock** p;
+
+	if(of->dirty == NULL) return NULL;
+
+	p = &(of->dirty[block % of->dirtyBuckets]);
+	while(*p != NULL){
+		if((*p)->block == block) return p;
+		p = &((*p)->next);
+	}
+
+	return NULL;
+}
+
+/** Insert a dirty block, the hash table doubles when it has more blocks than buckets. The lock of
+ * the open file must be held
+ *
+ * @return false if there is not enough memory
+ */
+private bool pubcfs_insertDirtyBlock(pubcfs_openFile* of, pubcfs_dirtyBlock* db){
+	pubcfs_dirtyBlock **buckets, *e, *next;
+	size_t i, newBuckets;
+
+	if(of->dirtyCount >= of->dirtyBuckets){
+		newBuckets = (of->dirtyBuckets == 0) ? 16 : of->dirtyBuckets * 2;
+		buckets = (pubcfs_dirtyBlock**)calloc(newBuckets, sizeof(pubcfs_dirtyBlock*));
+		if(buckets == NULL) return false;
+		for(i = 0; i < of->dirtyBuckets; i++){
+			for(e = of->dirty[i]; e != NULL; e = next){
+				next = e->next;
+				e->next = buckets[e->block % newBuckets];
+				buckets[e->block % newBuckets] = e;
+			}
+		}
+		free(of->dirty);
+		of->dirty = buckets;
+		of->dirtyBuckets = newBuckets;
+	}
+
+	db->next = of->dirty[db->block % of->dirtyBuckets];
+	of->dirty[db->block % of->dirtyBuckets] = db;
+	of->dirtyCount++;
+
+	return true;
+}
+
+/** Read and decrypt a part of a single block of a cfb8 folder without decrypting all the block
+ *
+ * With cfb8 a byte needs only the 16 encrypted bytes before it, so only the requested bytes and
+ * the 16 bytes before them (or the start of the block) are read and decrypted, and a small read
+ * costs the same with any block size. The block is taken from the block cache if it is there,
+ * otherwise it is not added because it is not entirely decrypted. An entire block of zeros is a
+ * hole (see pubcfs_isHole) but a part of zeros can be a real encrypted part, so if the read bytes
+ * are all zeros the read is left to the blocks.
+ *
+ * @param fh the handle of the file, the open file must not have dirty blocks
+ * @param bufp like pubcfs_readFileBuf
+ * @param ris it will contain the return value of pubcfs_readFileBuf
+ *
+ * @return true if the read is done, false if it must be done with the entire blocks
+ */
+private bool pubcfs_readWindow(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+							   ubyte** bufp, size_t count, off_t offset, int* ris){
+	ioRingOp_t op;
+	ulong block, generation;
+	size_t blockSize, start, winStart, lookBehind, i;
+	ubyte* buf;
+
+	blockSize = ctx->blockSize;
+	block = offset / blockSize;
+	start = offset - block * blockSize;
+	if(count > blockSize - start) count = blockSize - start;
+
+	buf = (ubyte*)malloc(blockSize);
+	if(buf == NULL){
+		*ris = -1;
+		return true;
+	}
+
+	if(ctx->blockCache != NULL
+	   && blockCache_get(ctx->blockCache, fh->dev, fh->ino, block, buf, &generation)){
+		if(start > 0) memmove(buf, buf + start, count);
+		*bufp = buf;
+		*ris = count;
+		return true;
+	}
+
+	//a byte in the first 16 bytes of the block needs the iv, so the block is read from its start
+	winStart = (start >= 16) ? start - 16 : 0;
+	lookBehind = start - winStart;
+	op.fd = fh->fd;
+	op.buf = buf;
+	op.len = lookBehind + count;
+	op.offset = block * blockSize + winStart;
+	op.write = false;
+	if(ioRing_run(pubcfs_getIoRing(ctx), &op, 1) != 0){
+		free(buf);
+		*ris = -1;
+		return true;
+	}
+
+	for(i = 0; i < op.done && buf[i] == 0; i++);
+	if(op.done > 0 && i == op.done){
+		free(buf);
+		return false;
+	}
+
+	if(op.done <= lookBehind){
+		//the end of the file is before the offset
+		count = 0;
+	}else if(winStart == 0){
+		pubcfs_decryptCfb8(cctx, NULL, buf, buf, op.done);
+		count = op.done - lookBehind;
+		if(start > 0) memmove(buf, buf + start, count);
+	}else{
+		//the look-behind is the iv of the requested bytes, they are decrypted at the buffer start
+		count = op.done - lookBehind;
+		pubcfs_decryptCfb8(cctx, buf, buf + lookBehind, buf, count);
+	}
+
+	*bufp = buf;
+	*ris = count;
+	return true;
+}
+
+/** Read and decrypt a part of an open file into a new buffer, the dirty blocks are taken from
+ * memory and the other blocks are read with pubcfs_readBlocks, so a read needs at most a pread.
+ * The blocks are decrypted in the returned buffer and, if the offset is the start of a block, the
+ * requested bytes are not moved
+ *
+ * @param fh the handle of the file
+ * @param bufp it will point to the buffer with the plain data at its start, the caller must
+ * deallocate it with the free function
+ * @param count the bytes to read
+ * @param offset the offset of the first byte
+ *
+ * @return the read bytes (less than count only at the end of the file) or -1 if error
+ */
+int pubcfs_readFileBuf(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+					   ubyte** bufp, size_t count, off_t offset){
+	pubcfs_openFile* of;
+	pubcfs_dirtyBlock** p;
+	ulong first;
+	size_t i, n, blockSize, start, valid;
+	off_t size, blockStart;
+	int* sizes;
+	ubyte* blocks;
+	bool window;
+	int ris;
+
+	*bufp = NULL;
+	if(count == 0) return 0;
+
+	blockSize = ctx->blockSize;
+	first = offset / blockSize;
+	n = (offset + count - 1) / blockSize - first + 1;
+
+	//a part of a single block of a cfb8 folder is decrypted alone, see pubcfs_readWindow
+	of = fh->of;
+	if(n == 1 && count < blockSize && ctx->cipher == PUBCFS_CIPHER_CFB8){
+		if(of != NULL) pthread_mutex_lock(&(of->lock));
+		window = (of == NULL || of->dirtyCount == 0);
+		if(of != NULL) pthread_mutex_unlock(&(of->lock));
+		if(window && pubcfs_readWindow(ctx, cctx, fh, bufp, count, offset, &ris)) return ris;
+	}
+
+	sizes = (int*)malloc(n * sizeof(int));
+	blocks = (ubyte*)malloc(n * blockSize);
+	if(sizes == NULL || blocks == NULL){
+		free(sizes);
+		free(blocks);
+		return -1;
+	}
+	for(i = 0; i < n; i++) sizes[i] = -1;
+
+	//the dirty blocks are copied, pubcfs_readBlocks skips them
+	size = -1;
+	if(of != NULL){
+		pthread_mutex_lock(&(of->lock));
+		if(of->dirtyCount > 0){
+			for(i = 0; i < n; i++){
+				p = pubcfs_findDirtyBlock(of, first + i);
+				if(p == NULL) continue;
+				memcpy(blocks + i * blockSize, (*p)->data, (*p)->size);
+				sizes[i] = (*p)->size;
+			}
+			size = of->size;
+		}
+		pthread_mutex_unlock(&(of->lock));
+	}
+
+	if(pubcfs_readBlocks(ctx, cctx, fh, first, n, blocks, sizes) != 0){
+		free(sizes);
+		free(blocks);
+		return -1;
+	}
+
+	/* a dirty block after the end of the file leaves a gap that is not yet in the file, it
+	 * contains zeros until the write-back */
+	for(i = 0; i < n; i++){
+		blockStart = (first + i) * blockSize;
+		if(blockStart >= size) break;
+		valid = (size - blockStart > (off_t)blockSize) ? blockSize : (size_t)(size - blockStart);
+		if(sizes[i] < (int)valid){
+			memset(blocks + i * blockSize + sizes[i], 0, valid - sizes[i]);
+			sizes[i] = valid;
+		}
+	}
+
+	//the data ends with the first partial block
+	valid = 0;
+	for(i = 0; i < n; i++){
+		valid = i * blockSize + sizes[i];
+		if(sizes[i] < (int)blockSize) break;
+	}
+
+	start = offset - first * blockSize;
+	count = (valid > start) ? ((valid - start < count) ? valid - start : count) : 0;
+	if(start > 0) memmove(blocks, blocks + start, count);
+
+	free(sizes);
+	*bufp = blocks;
+	return count;
+}
+
+/** Read and decrypt a part of an open file, see pubcfs_readFileBuf
+ *
+ * @param fh the handle of the file
+ * @param buf the buffer that will contain the plain data
+ * @param count the bytes to read
+ * @param offset the offset of the first byte
+ *
+ * @return the read bytes (less than count only at the end of the file) or -1 if error
+ */
+int pubcfs_readFile(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+					ubyte* buf, size_t count, off_t offset){
+	ubyte* blocks;
+	int ris;
+
+	ris = pubcfs_readFileBuf(ctx, cctx, fh, &blocks, count, offset);
+	if(ris > 0) memcpy(buf, blocks, ris);
+	free(blocks);
+
+	return ris;
+}
+
+/** Get a dirty block for changing it, if the block is not dirty it is created. The caller must
+ * hold the lock of the open file, change the data and update the size of the block
+ *
+ * @param fh the handle used for the write, it must be writable
+ * @param load true if the current content of the block must be read, it is false only when all
+ * the block will be overwritten
+ *
+ * @return the dirty block, or NULL on error (errno is set)
+ */
+pubcfs_dirtyBlock* pubcfs_getDirtyBlock(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx,
+										pubcfs_fileHandle* fh, ulong block, bool load){
+	pubcfs_openFile* of;
+	pubcfs_dirtyBlock** p;
+	pubcfs_dirtyBlock* db;
+	int ris;
+
+	of = fh->of;
+	p = pubcfs_findDirtyBlock(of, block);
+	if(p != NULL) return *p;
+
+	//the write-back needs a writable descriptor that lives as long as the open file
+	if(of->fd < 0){
+		of->fd = dup(fh->fd);
+		if(of->fd < 0) return NULL;
+	}
+
+	db = (pubcfs_dirtyBlock*)malloc(sizeof(pubcfs_dirtyBlock) + ctx->blockSize);
+	if(db == NULL){
+		errno = ENOMEM;
+		return NULL;
+	}
+	db->block = block;
+	db->size = 0;
+	db->from = 0;
+
+	if(load){
+		ris = pubcfs_readBlock(ctx, cctx, fh, block, db->data);
+		if(ris < 0){
+			free(db);
+			return NULL;
+		}
+		db->size = ris;
+
+		/* with cfb8 the read bytes are still encrypted in the file, but the plain zeros can be a
+		 * hole whose zeros are not their encryption */
+		if(ctx->cipher == PUBCFS_CIPHER_CFB8 && !pubcfs_isHole(db->data, ris, ctx->blockSize)){
+			db->from = ris;
+		}
+	}
+
+	if(!pubcfs_insertDirtyBlock(of, db)){
+		free(db);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pubcfs_addDirtyBytes(ctx, ctx->blockSize);
+
+	return db;
+}
+
+/** Record a change of a dirty block, every change of the data or of the size must call it
+ *
+ * The bytes of a cfb8 block depend only on the previous ones, so the bytes before the first
+ * changed one remain the same and the write-back encrypts and writes only the others.
+ *
+ * @param offset the first changed byte in the block
+ */
+void pubcfs_markChanged(pubcfs_dirtyBlock* db, size_t offset){
+	if(offset < db->from) db->from = offset;
+}
+
+/** Returns the bytes at the start of a dirty block that the write-back doesn't write again, 0 if
+ * all the block is written. The others are encrypted from the 16 bytes before them in the file,
+ * so they must be at least PUBCFS_SUFFIX_MIN for saving more than the additional read
+ */
+private size_t pubcfs_unchangedPrefix(pubcfs_context* ctx, pubcfs_dirtyBlock* db){
+	if(ctx->cipher != PUBCFS_CIPHER_CFB8 || db->from < PUBCFS_SUFFIX_MIN || db->from >= db->size){
+		return 0;
+	}
+	if(pubcfs_isHole(db->data, db->size, ctx->blockSize)) return 0;
+
+	return db->from;
+}
+
+private int pubcfs_compareDirtyBlocks(const void* a, const void* b){
+	ulong ba, bb;
+
+	ba = (*(pubcfs_dirtyBlock**)a)->block;
+	bb = (*(pubcfs_dirtyBlock**)b)->block;
+
+	return (ba > bb) - (ba < bb);
+}
+
+/** Write a hole in a file, the file grows if the hole ends after its end
+ *
+ * @return 0 or -errno
+ */
+private int pubcfs_writeHole(int fd, off_t offset, size_t len){
+	struct stat st;
+	ubyte* zeros;
+	ioRingOp_t op;
+	int ris;
+
+	if(fstat(fd, &st) != 0) return -errno;
+
+	if(offset < st.st_size
+	   && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) != 0){
+		if(errno != EOPNOTSUPP && errno != ENOSYS) return -errno;
+
+		//the encrypted zeros are read as a hole too
+		zeros = (ubyte*)calloc(1, len);
+		if(zeros == NULL) return -ENOMEM;
+		op.fd = fd;
+		op.buf = zeros;
+		op.len = len;
+		op.offset = offset;
+		op.write = true;
+		ris = ioRing_run(NULL, &op, 1);
+		free(zeros);
+		if(ris != 0) return -errno;
+	}
+
+	if(offset + (off_t)len > st.st_size && ftruncate(fd, offset + len) != 0) return -errno;
+
+	return 0;
+}
+
+/** Write a run of encrypted blocks and remove them from the dirty blocks, the lock of the open
+ * file must be held
+ *
+ * @param blocks the sorted dirty blocks, the run goes from first to last (excluded)
+ * @param e_buf the encrypted blocks of the run, or NULL if the blocks are holes
+ * @param runSize the bytes of the run
+ *
+ * @param skip the bytes at the start of the first block that are not written, see
+ * pubcfs_unchangedPrefix
+ *
+ * @return 0 or -errno if error, in this case the blocks remain dirty
+ */
+private int pubcfs_writeRun(pubcfs_context* ctx, pubcfs_openFile* of, pubcfs_dirtyBlock** blocks,
+							size_t first, size_t last, ubyte* e_buf, size_t runSize, size_t skip){
+	pubcfs_dirtyBlock** p;
+	ioRingOp_t op;
+	size_t i;
+	int err;
+
+	if(e_buf == NULL){
+		err = pubcfs_writeHole(of->fd, blocks[first]->block * ctx->blockSize, runSize);
+	}else{
+		op.fd = of->fd;
+		op.buf = e_buf;
+		op.len = runSize;
+		op.offset = blocks[first]->block * ctx->blockSize + skip;
+		op.write = true;
+		err = (ioRing_run(pubcfs_getIoRing(ctx), &op, 1) == 0) ? 0 : -errno;
+	}
+
+	//the cached blocks are invalidated after the write, see blockCache_put
+	pubcfs_invalidateBlocks(ctx, of->dev, of->ino, blocks[first]->block, blocks[last - 1]->block);
+	if(err != 0) return err;
+
+	for(i = first; i < last; i++){
+		p = pubcfs_findDirtyBlock(of, blocks[i]->block);
+		*p = blocks[i]->next;
+		free(blocks[i]);
+		of->dirtyCount--;
+		pubcfs_addDirtyBytes(ctx, -(long)ctx->blockSize);
+	}
+
+	return 0;
+}
+
+/** Write all the dirty blocks of an open file, the lock of the open file must be held
+ *
+ * The blocks are sorted and the consecutive ones are written with a single pwrite. Every run of
+ * blocks passes through three stages: the plain data is copied into a buffer, the buffer is
+ * encrypted by the crypto threads and then it is written. The encryption of a run and the write
+ * of the previous one are done at the same time, with two buffers. The consecutive blocks of
+ * zeros are a run written as a hole, without copy and encryption. A cfb8 block changed only after
+ * its first PUBCFS_SUFFIX_MIN bytes is a run alone, from the first changed byte to its end. On
+ * error the blocks not written remain dirty.
+ *
+ * @return 0 or -errno if error
+ */
+int pubcfs_writeBackLocked(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_openFile* of){
+	pubcfs_dirtyBlock **blocks, *db;
+	pubcfs_cryptBatch batch;
+	ubyte* bufs[2];
+	size_t i, j, n, maxRun, runSize, prevFirst, prevLast, prevSize, valid, skip, prevSkip;
+	off_t start;
+	ubyte prev[16];
+	int err, turn;
+	bool hole, prevHole;
+
+	if(of->dirtyCount == 0) return 0;
+
+	n = of->dirtyCount;
+	blocks = (pubcfs_dirtyBlock**)malloc(n * sizeof(pubcfs_dirtyBlock*));
+	if(blocks == NULL) return -ENOMEM;
+	j = 0;
+	for(i = 0; i < of->dirtyBuckets; i++){
+		for(db = of->dirty[i]; db != NULL; db = db->next){
+			/* a block written after the end of the file is partial also if the file grew after
+			 * it, the rest is a part of the gap and it contains zeros */
+			start = db->block * ctx->blockSize;
+			valid = (of->size - start > (off_t)ctx->blockSize) ? ctx->blockSize
+															  : (size_t)(of->size - start);
+			if(db->size < valid){
+				pubcfs_markChanged(db, db->size);
+				memset(db->data + db->size, 0, valid - db->size);
+				db->size = valid;
+			}
+			blocks[j++] = db;
+		}
+	}
+	qsort(blocks, n, sizeof(pubcfs_dirtyBlock*), pubcfs_compareDirtyBlocks);
+
+	maxRun = PUBCFS_IO_MAXSPAN / ctx->blockSize;
+	if(maxRun == 0) maxRun = 1;
+	if(maxRun > n) maxRun = n;
+	bufs[0] = (ubyte*)malloc(2 * maxRun * ctx->blockSize);
+	if(bufs[0] == NULL){
+		free(blocks);
+		return -ENOMEM;
+	}
+	bufs[1] = bufs[0] + maxRun * ctx->blockSize;
+
+	err = 0;
+	turn = 0;
+	prevFirst = prevLast = prevSize = prevSkip = 0;
+	prevHole = false;
+	for(i = 0; i < n; i = j){
+		//a run ends with a partial block, with a gap or where the holes start or end
+		hole = pubcfs_isHole(blocks[i]->data, blocks[i]->size, ctx->blockSize);
+
+		//the changed suffix of a block continues the cipher text of the unchanged prefix
+		skip = pubcfs_unchangedPrefix(ctx, blocks[i]);
+		if(skip > 0
+		   && pread(of->fd, prev, 16, blocks[i]->block * ctx->blockSize + skip - 16) != 16){
+			skip = 0;
+		}
+
+		if(skip > 0){
+			runSize = blocks[i]->size - skip;
+			j = i + 1;
+			pubcfs_encryptCfb8(cctx, prev, blocks[i]->data + skip, bufs[turn], runSize);
+		}else{
+			runSize = 0;
+			j = i;
+			do{
+				if(!hole) memcpy(bufs[turn] + runSize, blocks[j]->data, blocks[j]->size);
+				runSize += blocks[j]->size;
+				j++;
+			}while(j < n && j - i < maxRun && blocks[j - 1]->size == ctx->blockSize
+				   && blocks[j]->block == blocks[j - 1]->block + 1
+				   && pubcfs_isHole(blocks[j]->data, blocks[j]->size, ctx->blockSize) == hole
+				   && pubcfs_unchangedPrefix(ctx, blocks[j]) == 0);
+
+			if(!hole){
+				pubcfs_cryptStart(ctx, cctx, &batch, true, blocks[i]->block, bufs[turn],
+								  bufs[turn], runSize);
+			}
+		}
+		if(prevLast > prevFirst){
+			err = pubcfs_writeRun(ctx, of, blocks, prevFirst, prevLast,
+								  prevHole ? NULL : bufs[1 - turn], prevSize, prevSkip);
+		}
+		if(!hole && skip == 0) pubcfs_cryptWait(&batch);
+		if(err != 0) break;
+
+		prevFirst = i;
+		prevLast = j;
+		prevSize = runSize;
+		prevSkip = skip;
+		prevHole = hole;
+		turn = 1 - turn;
+	}
+	if(err == 0 && prevLast > prevFirst){
+		err = pubcfs_writeRun(ctx, of, blocks, prevFirst, prevLast,
+							  prevHole ? NULL : bufs[1 - turn], prevSize, prevSkip);
+	}
+
+	free(bufs[0]);
+	free(blocks);
+
+	if(err != 0) of->error = err;
+
+	return err;
+}
+
+/** Write all the dirty blocks of an open file
+ *
+ * @return 0, or -errno if this write-back or a previous background one failed
+ */
+int pubcfs_writeBack(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_openFile* of){
+	int ris;
+
+	pthread_mutex_lock(&(of->lock));
+	ris = pubcfs_writeBackLocked(ctx, cctx, of);
+	if(ris == 0) ris = of->error;
+	of->error = 0;
+	pthread_mutex_unlock(&(of->lock));
+
+	return ris;
+}
+
+/** Change the size of a backing file, the dirty blocks must be already written
+ *
+ * When the file grows its partial last block is completed with zeros and the new partial last
+ * block contains encrypted zeros, so the entire blocks between them are a hole that is read as
+ * zeros (see pubcfs_isHole). When the file shrinks and its new last block is a partial part of
+ * a hole it is replaced with encrypted zeros, because a partial block is never a hole. With xts
+ * the new last block is decrypted with its old size and encrypted again with the new one, because
+ * xts encrypts a block as one data unit and a part of its ciphertext is not the ciphertext of the
+ * part of the data. cfb8 is a stream mode and its blocks are simply truncated.
+ *
+ * @param fd a descriptor of the backing file open for reading and writing
+ *
+ * @return 0 or -errno
+ */
+int pubcfs_setFileSize(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, int fd, off_t newSize){
+	pubcfs_fileHandle fh;
+	struct stat st;
+	ubyte *buf, *plain;
+	ulong block, oldBlock;
+	size_t blockSize, end, oldEnd;
+	ssize_t ris;
+	bool hole, rewrite;
+	int err;
+
+	if(fstat(fd, &st) != 0) return -errno;
+	blockSize = ctx->blockSize;
+	block = newSize / blockSize;
+	end = newSize % blockSize;
+
+	buf = (ubyte*)malloc(2 * blockSize);
+	if(buf == NULL) return -ENOMEM;
+	plain = buf + blockSize;
+	fh.fd = fd;
+	fh.dev = st.st_dev;
+	fh.ino = st.st_ino;
+	fh.of = NULL;
+
+	//the old last block is completed with zeros
+	if(newSize > st.st_size && st.st_size % blockSize != 0){
+		oldBlock = st.st_size / blockSize;
+		oldEnd = (block == oldBlock) ? end : blockSize;
+		ris = pubcfs_readBlock(ctx, cctx, &fh, oldBlock, buf);
+		if(ris < 0) goto err;
+		memset(buf + ris, 0, oldEnd - ris);
+		ris = pubcfs_writeBlock(ctx, cctx, &fh, oldBlock, buf, oldEnd);
+		if(ris != (ssize_t)oldEnd) goto err;
+	}
+
+	/* the new last block contains encrypted zeros if it starts after the old end or if it was a
+	 * part of a hole, that is read before the truncation when it is still entire. With xts it is
+	 * decrypted with its old size and written again after the truncation */
+	hole = false;
+	rewrite = false;
+	if(end != 0 && newSize < st.st_size){
+		ris = pread(fd, buf, blockSize, block * blockSize);
+		if(ris < 0) goto err;
+		hole = pubcfs_isHole(buf, ris, blockSize);
+		if(!hole && ctx->cipher == PUBCFS_CIPHER_XTS){
+			pubcfs_decryptBlock(ctx, cctx, block, buf, plain, ris);
+			rewrite = true;
+		}
+	}else if(end != 0 && (off_t)(block * blockSize) >= st.st_size){
+		hole = true;
+	}
+	if(hole){
+		memset(plain, 0, end);
+		rewrite = true;
+	}
+
+	if(ftruncate(fd, newSize) != 0){
+		ris = -1;
+		goto err;
+	}
+	if(rewrite){
+		ris = pubcfs_writeBlock(ctx, cctx, &fh, block, plain, end);
+		if(ris != (ssize_t)end) goto err;
+	}
+
+	free(buf);
+	return 0;
+
+	//Errors
+	err:
+		err = (ris < 0) ? errno : EIO;
+		free(buf);
+		return -err;
+}
+
+/** Write zeros in a part of a block through its dirty block, the lock of the open file must be
+ * held
+ *
+ * @param start the first byte, end is in the same block
+ *
+ * @return 0 or -errno
+ */
+private int pubcfs_zeroBlockPart(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx,
+								 pubcfs_fileHandle* fh, off_t start, off_t end){
+	pubcfs_dirtyBlock* db;
+	size_t from, to;
+
+	db = pubcfs_getDirtyBlock(ctx, cctx, fh, start / ctx->blockSize, true);
+	if(db == NULL) return -errno;
+
+	from = start % ctx->blockSize;
+	to = from + (end - start);
+	if(to > db->size) to = db->size;
+	if(from < to){
+		pubcfs_markChanged(db, from);
+		memset(db->data + from, 0, to - from);
+	}
+
+	return 0;
+}
+
+/** Write zeros in a range of an open file, the dirty blocks must be already written and the lock
+ * of the open file must be held
+ *
+ * The entire blocks of the range become a hole of the backing file, the parts of the partial
+ * blocks at its ends are zeroed in their dirty blocks. The last block of the file is never
+ * punched if it is partial.
+ *
+ * @return 0 or -errno
+ */
+private int pubcfs_punchRange(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+							  off_t offset, off_t end){
+	pubcfs_openFile* of;
+	ulong first, last;
+	off_t headEnd, tailStart;
+	size_t blockSize;
+	int ris;
+
+	of = fh->of;
+	blockSize = ctx->blockSize;
+	if(end > of->size) end = of->size;
+	if(offset >= end) return 0;
+
+	//the entire blocks inside the range, from first to last (excluded)
+	first = (offset + blockSize - 1) / blockSize;
+	last = end / blockSize;
+	if(last > first){
+		ris = pubcfs_writeHole(fh->fd, first * blockSize, (last - first) * blockSize);
+		pubcfs_invalidateBlocks(ctx, of->dev, of->ino, first, last - 1);
+		if(ris < 0) return ris;
+	}
+
+	headEnd = ((off_t)(first * blockSize) < end) ? (off_t)(first * blockSize) : end;
+	if(offset < headEnd){
+		ris = pubcfs_zeroBlockPart(ctx, cctx, fh, offset, headEnd);
+		if(ris < 0) return ris;
+	}
+	tailStart = ((off_t)(last * blockSize) > headEnd) ? (off_t)(last * blockSize) : headEnd;
+	if(tailStart < end){
+		ris = pubcfs_zeroBlockPart(ctx, cctx, fh, tailStart, end);
+		if(ris < 0) return ris;
+	}
+
+	return 0;
+}
+
+/** Allocate or punch a range of an open file, see fallocate(2)
+ *
+ * The space is allocated in the backing file with FALLOC_FL_KEEP_SIZE, the allocated blocks
+ * contain zeros that are holes read as plain zeros (see pubcfs_isHole). If the file grows its
+ * size is changed with pubcfs_setFileSize, that encrypts only the old and the new partial last
+ * blocks, so the zeros of the range are never encrypted. A punched range is zeroed with
+ * pubcfs_punchRange.
+ *
+ * @param fh the handle of the file, it must be writable
+ * @param mode 0, FALLOC_FL_KEEP_SIZE or FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE
+ *
+ * @return 0 or -errno
+ */
+int pubcfs_allocate(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh, int mode,
+					off_t offset, off_t len){
+	pubcfs_openFile* of;
+	off_t end;
+	int ris;
+
+	of = fh->of;
+	end = offset + len;
+
+	pthread_mutex_lock(&(of->lock));
+
+	//the backing file must have the blocks and the size of the open file
+	ris = pubcfs_writeBackLocked(ctx, cctx, of);
+	if(ris < 0) goto ret;
+
+	if(mode & FALLOC_FL_PUNCH_HOLE){
+		ris = pubcfs_punchRange(ctx, cctx, fh, offset, end);
+		if(ris == 0 && (ctx->dirtyLimit == 0 || pubcfs_dirtyLimitReached(ctx))){
+			ris = pubcfs_writeBackLocked(ctx, cctx, of);
+		}
+		goto ret;
+	}
+
+	if(fallocate(fh->fd, FALLOC_FL_KEEP_SIZE, offset, len) != 0){
+		ris = -errno;
+		goto ret;
+	}
+	if(!(mode & FALLOC_FL_KEEP_SIZE) && end > of->size){
+		ris = pubcfs_setFileSize(ctx, cctx, fh->fd, end);
+		if(ris == 0) of->size = end;
+	}
+
+	ret:
+		pthread_mutex_unlock(&(of->lock));
+		return ris;
+}
+
+/** Copy plain data into the dirty blocks of an open file, the lock of the open file must be held
+ * and the file must not end before offset
+ *
+ * @return 0 or -errno
+ */
+private int pubcfs_writeDirty(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fh,
+							  ubyte* buf, size_t count, off_t offset){
+	pubcfs_dirtyBlock* db;
+	size_t done, n, blockOffset;
+
+	for(done = 0; done < count; done += n){
+		blockOffset = (offset + done) % ctx->blockSize;
+		n = ctx->blockSize - blockOffset;
+		if(n > count - done) n = count - done;
+
+		//the current content is read only if the block is not entirely overwritten
+		db = pubcfs_getDirtyBlock(ctx, cctx, fh, (offset + done) / ctx->blockSize,
+								  n != ctx->blockSize);
+		if(db == NULL) return -errno;
+		pubcfs_markChanged(db, (db->size < blockOffset) ? db->size : blockOffset);
+		if(db->size < blockOffset) memset(db->data + db->size, 0, blockOffset - db->size);
+		memcpy(db->data + blockOffset, buf + done, n);
+		if(db->size < blockOffset + n) db->size = blockOffset + n;
+	}
+	if(offset + (off_t)count > fh->of->size) fh->of->size = offset + count;
+
+	return 0;
+}
+
+/** Copy plain data from a file into the dirty blocks of another one, the lock of the output open
+ * file must be held
+ *
+ * @param in the handle of the input file, its dirty blocks must be already written
+ *
+ * @return 0 or -errno
+ */
+private int pubcfs_copyPlain(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* in,
+							 off_t offIn, pubcfs_fileHandle* fhOut, off_t offOut, size_t len){
+	ubyte* buf;
+	size_t done, chunk;
+	int n, ris;
+
+	if(len == 0) return 0;
+
+	chunk = (len < PUBCFS_IO_MAXSPAN) ? len : PUBCFS_IO_MAXSPAN;
+	buf = (ubyte*)malloc(chunk);
+	if(buf == NULL) return -ENOMEM;
+
+	ris = 0;
+	for(done = 0; done < len; done += n){
+		n = pubcfs_readFile(ctx, cctx, in, buf, (len - done < chunk) ? len - done : chunk,
+							offIn + done);
+		if(n <= 0){
+			ris = (n < 0) ? -errno : -EIO;
+			break;
+		}
+		ris = pubcfs_writeDirty(ctx, cctx, fhOut, buf, n, offOut + done);
+		if(ris == 0 && (ctx->dirtyLimit == 0 || pubcfs_dirtyLimitReached(ctx))){
+			ris = pubcfs_writeBackLocked(ctx, cctx, fhOut->of);
+		}
+		if(ris < 0) break;
+	}
+
+	free(buf);
+	return ris;
+}
+
+/** Copy encrypted data from a backing file to another, the data is shared with a reflink
+ * (FICLONERANGE) if the backing file system can do it, otherwise it is copied with
+ * copy_file_range or, as last resort, read and written without decrypting it
+ *
+ * @return 0 or -errno
+ */
+private int pubcfs_copyCipher(pubcfs_context* ctx, int fdIn, off_t offIn, int fdOut, off_t offOut,
+							  size_t len){
+	struct file_clone_range clone;
+	ioRingOp_t op;
+	loff_t in, out;
+	ssize_t n;
+	size_t chunk;
+	ubyte* buf;
+	int ris;
+
+	clone.src_fd = fdIn;
+	clone.src_offset = offIn;
+	clone.src_length = len;
+	clone.dest_offset = offOut;
+	if(ioctl(fdOut, FICLONERANGE, &clone) == 0) return 0;
+
+	in = offIn;
+	out = offOut;
+	n = 0;
+	while(len > 0){
+		n = copy_file_range(fdIn, &in, fdOut, &out, len, 0);
+		if(n <= 0) break;
+		len -= n;
+	}
+	if(len == 0) return 0;
+	if(n < 0 && errno != EXDEV && errno != EOPNOTSUPP && errno != ENOSYS && errno != EINVAL){
+		return -errno;
+	}
+
+	chunk = (len < PUBCFS_IO_MAXSPAN) ? len : PUBCFS_IO_MAXSPAN;
+	buf = (ubyte*)malloc(chunk);
+	if(buf == NULL) return -ENOMEM;
+
+	ris = 0;
+	while(len > 0){
+		op.fd = fdIn;
+		op.buf = buf;
+		op.len = (len < chunk) ? len : chunk;
+		op.offset = in;
+		op.write = false;
+		if(ioRing_run(pubcfs_getIoRing(ctx), &op, 1) != 0){
+			ris = -errno;
+			break;
+		}
+		if(op.done < op.len){
+			ris = -EIO;
+			break;
+		}
+		op.fd = fdOut;
+		op.offset = out;
+		op.write = true;
+		if(ioRing_run(pubcfs_getIoRing(ctx), &op, 1) != 0){
+			ris = -errno;
+			break;
+		}
+		in += op.len;
+		out += op.len;
+		len -= op.len;
+	}
+
+	free(buf);
+	return ris;
+}
+
+/** Copy a range of an open file into another one, see copy_file_range(2)
+ *
+ * With cfb8 every block is encrypted from its start, so an entire block of ciphertext is valid at
+ * any block of any file of the folder; with xts the block number is the tweak, so it is valid only
+ * at the same block. When the two offsets allow it the entire blocks of the range are
+ * copied as ciphertext with pubcfs_copyCipher, and only the partial blocks at the ends of the
+ * range are decrypted and written as dirty blocks. Otherwise all the range is copied as plain
+ * data.
+ *
+ * @param fhIn the handle of the input file
+ * @param fhOut the handle of the output file, it must be writable
+ *
+ * @return the copied bytes (less than len only at the end of the input file) or -errno
+ */
+ssize_t pubcfs_copyRange(pubcfs_context* ctx, pubcfs_cryptoCtx* cctx, pubcfs_fileHandle* fhIn,
+						 off_t offIn, pubcfs_fileHandle* fhOut, off_t offOut, size_t len){
+	pubcfs_fileHandle in;
+	pubcfs_openFile *first, *second;
+	size_t blockSize, cipherStart, cipherEnd;
+	ssize_t ris;
+
+	blockSize = ctx->blockSize;
+
+	//the open files are always locked in the same order, so two opposite copies can't deadlock
+	first = (fhIn->of < fhOut->of) ? fhIn->of : fhOut->of;
+	second = (fhIn->of < fhOut->of) ? fhOut->of : fhIn->of;
+	pthread_mutex_lock(&(first->lock));
+	if(second != first) pthread_mutex_lock(&(second->lock));
+
+	ris = pubcfs_writeBackLocked(ctx, cctx, fhIn->of);
+	if(ris == 0) ris = pubcfs_writeBackLocked(ctx, cctx, fhOut->of);
+	if(ris < 0) goto ret;
+
+	if(offIn >= fhIn->of->size){
+		ris = 0;
+		goto ret;
+	}
+	if(len > (size_t)(fhIn->of->size - offIn)) len = fhIn->of->size - offIn;
+	if(fhIn->of == fhOut->of && offIn < offOut + (off_t)len && offOut < offIn + (off_t)len){
+		ris = -EINVAL;
+		goto ret;
+	}
+
+	//the gap before the range is a part of the output file, see pubcfs_setFileSize
+	if(offOut > fhOut->of->size){
+		ris = pubcfs_setFileSize(ctx, cctx, fhOut->fd, offOut);
+		if(ris < 0) goto ret;
+		fhOut->of->size = offOut;
+	}
+
+	//the input is read from its backing file, the open file is already locked
+	in.fd = fhIn->fd;
+	in.dev = fhIn->dev;
+	in.ino = fhIn->ino;
+	in.of = NULL;
+
+	//the entire blocks of the input from cipherStart to cipherEnd, relative to the offsets
+	cipherStart = cipherEnd = len;
+	if(offIn % blockSize == offOut % blockSize
+	   && (ctx->cipher == PUBCFS_CIPHER_CFB8 || offIn == offOut)){
+		cipherStart = (blockSize - offIn % blockSize) % blockSize;
+		cipherEnd = ((offIn + len) / blockSize) * blockSize - offIn;
+		if(cipherEnd <= cipherStart) cipherStart = cipherEnd = len;
+	}
+
+	/* the head is written before the ciphertext, so the partial last block of the output file is
+	 * loaded before the file grows */
+	ris = pubcfs_copyPlain(ctx, cctx, &in, offIn, fhOut, offOut, cipherStart);
+	if(ris < 0) goto ret;
+
+	if(cipherEnd > cipherStart){
+		ris = pubcfs_copyCipher(ctx, fhIn->fd, offIn + cipherStart, fhOut->fd, offOut + cipherStart,
+								cipherEnd - cipherStart);
+		pubcfs_invalidateBlocks(ctx, fhOut->dev, fhOut->ino, (offOut + cipherStart) / blockSize,
+								(offOut + cipherEnd) / blockSize - 1);
+		if(ris < 0) goto ret;
+		if(offOut + (off_t)cipherEnd > fhOut->of->size) fhOut->of->size = offOut + cipherEnd;
+
+		ris = pubcfs_copyPlain(ctx, cctx, &in, offIn + cipherEnd, fhOut, offOut + cipherEnd,
+							   len - cipherEnd);
+		if(ris < 0) goto ret;
+	}
+
+	ris = len;
+
+	ret:
+		if(second != first) pthread_mutex_unlock(&(second->lock));
+		pthread_mutex_unlock(&(first->lock));
+		return ris;
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+/**
+ * @file pubcfs_inode.c
+ * @brief Table of the inodes known by the kernel
+ *
+ * Every file or directory returned by a lookup has a pubcfs_inode with an O_PATH descriptor of its
+ * backing file, and the kernel uses its address as nodeid. The operations on a name use the *at
+ * calls on the descriptor of the parent, so only the name is encrypted and the full path is never
+ * built. The inodes are identified by the device and the inode of the backing file, so the hard
+ * links share the same nodeid, and they are removed when the kernel forgets all their lookups.
+ */
+
+#include <pubcfs.h>
+
+private inline pubcfs_inode** pubcfs_inodesBucket(pubcfs_context* ctx, dev_t dev, ino_t ino){
+	return &(ctx->inodes[((ulong)ino ^ ((ulong)dev << 7)) % ctx->inodesBuckets]);
+}
+
+private inline void pubcfs_setInodeCacheLocked(pubcfs_inode* inode, const struct stat* st){
+	inode->cached = true;
+	inode->cacheSize = st->st_size;
+	inode->cacheMtime = st->st_mtim;
+}
+
+/** Initialize the inode table and open the root folder
+ *
+ * @return 0 or -1 if the root folder can't be opened (errno is set)
+ */
+int pubcfs_initInodes(pubcfs_context* ctx){
+	struct stat st;
+
+	ctx->rootInode.fd = open(ctx->rootPath, O_PATH | O_DIRECTORY);
+	if(ctx->rootInode.fd < 0) return -1;
+	if(fstat(ctx->rootInode.fd, &st) != 0){
+		close(ctx->rootInode.fd);
+		return -1;
+	}
+	ctx->rootInode.dev = st.st_dev;
+	ctx->rootInode.ino = st.st_ino;
+	ctx->rootInode.nlookup = 1;
+	ctx->rootInode.next = NULL;
+	ctx->rootInode.cached = false;
+
+	ctx->inodes = (pubcfs_inode**)calloc(PUBCFS_INODES_MINBUCKETS, sizeof(pubcfs_inode*));
+	if(ctx->inodes == NULL){
+		close(ctx->rootInode.fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	ctx->inodesBuckets = PUBCFS_INODES_MINBUCKETS;
+	ctx->inodesCount = 0;
+	pthread_mutex_init(&(ctx->inodesLock), NULL);
+
+	return 0;
+}
+
+/** Close all the inodes, the kernel doesn't forget them at the unmount */
+void pubcfs_disposeInodes(pubcfs_context* ctx){
+	pubcfs_inode *inode, *next;
+	size_t i;
+
+	for(i = 0; i < ctx->inodesBuckets; i++){
+		for(inode = ctx->inodes[i]; inode != NULL; inode = next){
+			next = inode->next;
+			close(inode->fd);
+			free(inode);
+		}
+	}
+	free(ctx->inodes);
+	ctx->inodes = NULL;
+	ctx->inodesCount = 0;
+	close(ctx->rootInode.fd);
+	pthread_mutex_destroy(&(ctx->inodesLock));
+}
+
+/** Double the buckets of the inode table when it has more inodes than buckets, the lock of the
+ * table must be held. If there is not enough memory the table remains as it is */
+private void pubcfs_growInodes(pubcfs_context* ctx){
+	pubcfs_inode **buckets, *inode, *next;
+	size_t i, newBuckets, h;
+
+	if(ctx->inodesCount < ctx->inodesBuckets) return;
+
+	newBuckets = ctx->inodesBuckets * 2;
+	buckets = (pubcfs_inode**)calloc(newBuckets, sizeof(pubcfs_inode*));
+	if(buckets == NULL) return;
+	for(i = 0; i < ctx->inodesBuckets; i++){
+		for(inode = ctx->inodes[i]; inode != NULL; inode = next){
+			next = inode->next;
+			h = ((ulong)inode->ino ^ ((ulong)inode->dev << 7)) % newBuckets;
+			inode->next = buckets[h];
+			buckets[h] = inode;
+		}
+	}
+	free(ctx->inodes);
+	ctx->inodes = buckets;
+	ctx->inodesBuckets = newBuckets;
+}
+
+/** Look up a name in a folder and take a lookup reference to its inode, that must be released
+ * with pubcfs_forgetInode when the kernel forgets it
+ *
+ * @param parent the inode of the folder
+ * @param e_name the name in the backing folder, see pubcfs_encryptName
+ * @param st it will contain the attributes of the backing file
+ *
+ * @return the inode, or NULL if error (errno is set)
+ */
+pubcfs_inode* pubcfs_lookupInode(pubcfs_context* ctx, pubcfs_inode* parent, const char* e_name,
+								 struct stat* st){
+	pubcfs_inode **bucket, *inode;
+	int fd, err;
+
+	fd = openat(parent->fd, e_name, O_PATH | O_NOFOLLOW);
+	if(fd < 0) return NULL;
+	if(fstatat(fd, "", st, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW) != 0){
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&(ctx->inodesLock));
+	if(st->st_dev == ctx->rootInode.dev && st->st_ino == ctx->rootInode.ino){
+		pthread_mutex_unlock(&(ctx->inodesLock));
+		close(fd);
+		return &(ctx->rootInode);
+	}
+
+	bucket = pubcfs_inodesBucket(ctx, st->st_dev, st->st_ino);
+	for(inode = *bucket; inode != NULL; inode = inode->next){
+		if(inode->ino == st->st_ino && inode->dev == st->st_dev){
+			inode->nlookup++;
+			pthread_mutex_unlock(&(ctx->inodesLock));
+			close(fd);
+			return inode;
+		}
+	}
+
+	inode = (pubcfs_inode*)malloc(sizeof(pubcfs_inode));
+	if(inode == NULL){
+		pthread_mutex_unlock(&(ctx->inodesLock));
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	inode->dev = st->st_dev;
+	inode->ino = st->st_ino;
+	inode->fd = fd;
+	inode->nlookup = 1;
+	inode->cached = false;
+	inode->next = *bucket;
+	*bucket = inode;
+	ctx->inodesCount++;
+	pubcfs_growInodes(ctx);
+	pthread_mutex_unlock(&(ctx->inodesLock));
+
+	return inode;
+}
+
+/** Release lookup references, when the kernel forgets all of them the inode is removed
+ *
+ * @param nlookup the number of references to release
+ */
+void pubcfs_forgetInode(pubcfs_context* ctx, pubcfs_inode* inode, ulong nlookup){
+	pubcfs_inode** p;
+
+	if(inode == &(ctx->rootInode)) return;
+
+	pthread_mutex_lock(&(ctx->inodesLock));
+	inode->nlookup -= (nlookup < inode->nlookup) ? nlookup : inode->nlookup;
+	if(inode->nlookup > 0){
+		pthread_mutex_unlock(&(ctx->inodesLock));
+		return;
+	}
+	p = pubcfs_inodesBucket(ctx, inode->dev, inode->ino);
+	while(*p != inode) p = &((*p)->next);
+	*p = inode->next;
+	ctx->inodesCount--;
+	pthread_mutex_unlock(&(ctx->inodesLock));
+
+	pubcfs_invalidateRemoved(ctx, inode->fd);
+	close(inode->fd);
+	free(inode);
+}
+
+/** Check if the kernel can keep the cached data of a file that is opened, that is if the backing
+ * file is not changed since the kernel cached it, then remember its current state
+ *
+ * @param st the attributes of the backing file
+ *
+ * @return true if the cached data is still valid
+ */
+bool pubcfs_checkInodeCache(pubcfs_context* ctx, pubcfs_inode* inode, const struct stat* st){
+	bool valid;
+
+	pthread_mutex_lock(&(ctx->inodesLock));
+	valid = inode->cached && inode->cacheSize == st->st_size
+			&& inode->cacheMtime.tv_sec == st->st_mtim.tv_sec
+			&& inode->cacheMtime.tv_nsec == st->st_mtim.tv_nsec;
+	pubcfs_setInodeCacheLocked(inode, st);
+	pthread_mutex_unlock(&(ctx->inodesLock));
+
+	return valid;
+}
+
+/** Remember the state of a backing file changed through the kernel, its cache already contains
+ * the changes so it remains valid
+ *
+ * @param st the attributes of the backing file after the change
+ */
+void pubcfs_setInodeCache(pubcfs_context* ctx, pubcfs_inode* inode, const struct stat* st){
+	pthread_mutex_lock(&(ctx->inodesLock));
+	pubcfs_setInodeCacheLocked(inode, st);
+	pthread_mutex_unlock(&(ctx->inodesLock));
+}
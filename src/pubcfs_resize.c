@@ -0,0 +1,722 @@
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+/**
+ * @file pubcfs_resize.c
+ * @brief Conversion of a folder to another block size
+ *
+ * Every block is encrypted from its start, with its number as tweak if the cipher is not cfb8, so
+ * the block size is part of the format of the files and changing it needs to decrypt and encrypt
+ * again all the files. The conversion is done offline by pubcfs-config, with a pool of threads
+ * that convert different files at the same time. The folder is locked with pubcfs_lockFolder like
+ * pubcfs does when it mounts it, so a mounted folder is never converted.
+ *
+ * Every file is converted into a temporary file in the same directory, named
+ * PUBCFS_RESIZE_TMP_PREFIX followed by the inode number of the original file, that then replaces
+ * the original with a rename. The journal PUBCFS_RESIZE_JOURNAL_PATH contains the old and the
+ * new block size and, for every converted file, the inode number and the path; a file is added
+ * to the journal after that the temporary file is synced and before the rename. If the
+ * conversion is interrupted the next one completes the renames of the journal, deletes the other
+ * temporary files (see pubcfs_resizeIsTmp) and converts only the files that are not in the
+ * journal. The block size in the configuration is changed and the journal removed only at the
+ * end, and pubcfs refuses to mount a folder while the journal exists.
+ *
+ * The holes of the old blocks are holes of the new blocks too (see pubcfs_isHole), the new
+ * blocks of zeros are skipped so the converted files remain sparse.
+ */
+
+#include <pubcfs.h>
+
+typedef struct {
+	pubcfs_context* ctx; //only for the key and the crypto contexts of the threads
+	char* rootPath;
+	size_t oldBlockSize;
+	size_t newBlockSize;
+	char** done; //sorted paths of the files already converted
+	size_t doneCount;
+	pthread_mutex_t lock; //protect the next fields
+	FILE* journal;
+	int err;
+	ulong converted;
+} pubcfs_resizeState;
+
+typedef struct {
+	pubcfs_resizeState* st;
+	char* path; //relative to the root path
+} pubcfs_resizeJob;
+
+typedef struct {
+	char* name;
+	struct stat sb;
+	bool tmp; //temporary file of an interrupted conversion, see pubcfs_resizeIsTmp
+} pubcfs_resizeEntry;
+
+private int pubcfs_resizeCompare(const void* a, const void* b){
+	return strcmp(*(char**)a, *(char**)b);
+}
+
+/** Returns the path of the temporary file used for converting a file
+ *
+ * @param path the absolute path of the file
+ * @param ino the inode number of the file
+ *
+ * @return a string that you must deallocate with the free function, or NULL
+ */
+private char* pubcfs_resizeTmpPath(const char* path, ino_t ino){
+	char* tmpPath;
+	char* slash;
+
+	tmpPath = (char*)malloc(strlen(path) + strlen(PUBCFS_RESIZE_TMP_PREFIX) + 24);
+	if(tmpPath == NULL) return NULL;
+	strcpy(tmpPath, path);
+	slash = strrchr(tmpPath, '/');
+	sprintf(slash + 1, "%s%lu", PUBCFS_RESIZE_TMP_PREFIX, (ulong)ino);
+
+	return tmpPath;
+}
+
+/** Read until size bytes or the end of the file
+ *
+ * @return the read bytes or -1 if error
+ */
+private ssize_t pubcfs_resizeRead(int fd, ubyte* buf, size_t size){
+	size_t readed;
+	ssize_t ris;
+
+	for(readed = 0; readed < size; readed += ris){
+		ris = read(fd, buf + readed, size - readed);
+		if(ris < 0){
+			if(errno == EINTR){
+				ris = 0;
+				continue;
+			}
+			return -1;
+		}
+		if(ris == 0) break;
+	}
+
+	return readed;
+}
+
+/** Write encrypted blocks, the holes are skipped with lseek
+ *
+ * @return true if all the blocks are written
+ */
+private bool pubcfs_resizeWrite(int fd, ubyte* buf, size_t len, size_t blockSize){
+	size_t i, j, blockLen;
+
+	for(i = 0; i < len; i = j){
+		blockLen = (len - i < blockSize) ? len - i : blockSize;
+		if(pubcfs_isHole(buf + i, blockLen, blockSize)){
+			if(lseek(fd, blockLen, SEEK_CUR) < 0) return false;
+			j = i + blockLen;
+			continue;
+		}
+		for(j = i + blockLen; j < len; j += blockLen){
+			blockLen = (len - j < blockSize) ? len - j : blockSize;
+			if(pubcfs_isHole(buf + j, blockLen, blockSize)) break;
+		}
+		if(writen(fd, buf + i, j - i) != j - i) return false;
+	}
+
+	return true;
+}
+
+/** Convert a file into its temporary file
+ *
+ * @return PUBCFS_NOERR or an error
+ */
+private int pubcfs_resizeFile(pubcfs_resizeState* st, const char* relPath){
+	char *path, *tmpPath;
+	int in, out, err;
+	struct stat sb;
+	struct timespec times[2];
+	ubyte *e_buf, *p_buf, *o_buf;
+	size_t chunk, pLen, oLen, blockLen, i;
+	ssize_t readed;
+	ulong oldBlock, newBlock; //the numbers of the next blocks, the tweaks of xts
+	pubcfs_cryptoCtx* cctx;
+
+	cctx = pubcfs_getCryptoCtx(st->ctx);
+	err = PUBCFS_ERR_ENOMEM;
+
+	path = (char*)malloc(strlen(st->rootPath) + strlen(relPath) + 2);
+	if(path == NULL) goto ret;
+	sprintf(path, "%s/%s", st->rootPath, relPath);
+
+	in = open(path, O_RDONLY);
+	if(in < 0){
+		err = PUBCFS_ERR_READERROR;
+		goto ret1;
+	}
+	if(fstat(in, &sb) != 0){
+		err = PUBCFS_ERR_READERROR;
+		goto ret2;
+	}
+
+	tmpPath = pubcfs_resizeTmpPath(path, sb.st_ino);
+	if(tmpPath == NULL) goto ret2;
+	//an existing file is never replaced, the old temporary files are removed by pubcfs_resizeWalk
+	out = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if(out < 0){
+		err = PUBCFS_ERR_WRITEERROR;
+		goto ret3;
+	}
+
+	/* the file is read in chunks of old blocks, every old block is decrypted after the plain data
+	 * that wasn't enough for a new block, then the new blocks are encrypted. Only the last new
+	 * block of the file can be partial */
+	chunk = (PUBCFS_IO_MAXSPAN / st->oldBlockSize) * st->oldBlockSize;
+	if(chunk == 0) chunk = st->oldBlockSize;
+	e_buf = (ubyte*)malloc(chunk);
+	p_buf = (ubyte*)malloc(chunk + st->newBlockSize);
+	o_buf = (ubyte*)malloc(chunk + st->newBlockSize);
+	if(e_buf == NULL || p_buf == NULL || o_buf == NULL) goto ret4;
+
+	pLen = 0;
+	oldBlock = 0;
+	newBlock = 0;
+	loop{
+		readed = pubcfs_resizeRead(in, e_buf, chunk);
+		if(readed < 0){
+			err = PUBCFS_ERR_READERROR;
+			goto ret4;
+		}
+
+		for(i = 0; i < (size_t)readed; i += blockLen, oldBlock++){
+			blockLen = (readed - i < st->oldBlockSize) ? readed - i : st->oldBlockSize;
+			if(pubcfs_isHole(e_buf + i, blockLen, st->oldBlockSize)){
+				memset(p_buf + pLen, 0, blockLen);
+			}else{
+				pubcfs_decryptBlock(st->ctx, cctx, oldBlock, e_buf + i, p_buf + pLen, blockLen);
+			}
+			pLen += blockLen;
+		}
+
+		oLen = 0;
+		for(i = 0; i + st->newBlockSize <= pLen; i += st->newBlockSize, newBlock++){
+			if(pubcfs_isHole(p_buf + i, st->newBlockSize, st->newBlockSize)){
+				memset(o_buf + oLen, 0, st->newBlockSize);
+			}else{
+				pubcfs_encryptBlock(st->ctx, cctx, newBlock, p_buf + i, o_buf + oLen,
+									st->newBlockSize);
+			}
+			oLen += st->newBlockSize;
+		}
+		if((size_t)readed < chunk && i < pLen){ //end of file
+			pubcfs_encryptBlock(st->ctx, cctx, newBlock, p_buf + i, o_buf + oLen, pLen - i);
+			oLen += pLen - i;
+			i = pLen;
+		}
+		memmove(p_buf, p_buf + i, pLen - i);
+		pLen -= i;
+
+		if(oLen > 0 && !pubcfs_resizeWrite(out, o_buf, oLen, st->newBlockSize)){
+			err = PUBCFS_ERR_WRITEERROR;
+			goto ret4;
+		}
+
+		if((size_t)readed < chunk) break;
+	}
+
+	//a hole at the end of the file
+	if(ftruncate(out, lseek(out, 0, SEEK_CUR)) != 0){
+		err = PUBCFS_ERR_WRITEERROR;
+		goto ret4;
+	}
+
+	//the temporary file takes the place of the original, so it must have its attributes
+	if(fchown(out, sb.st_uid, sb.st_gid) != 0){
+		//only the owner of the folder can convert it, the other owners can't be kept
+	}
+	times[0] = sb.st_atim;
+	times[1] = sb.st_mtim;
+	if(fchmod(out, sb.st_mode & 07777) != 0 || futimens(out, times) != 0 || fsync(out) != 0){
+		err = PUBCFS_ERR_WRITEERROR;
+		goto ret4;
+	}
+
+	//the file is in the journal before the rename, see the comment at the start of this file
+	pthread_mutex_lock(&(st->lock));
+	if(fprintf(st->journal, "%lu %s\n", (ulong)sb.st_ino, relPath) < 0
+	   || fflush(st->journal) != 0 || fsync(fileno(st->journal)) != 0){
+		pthread_mutex_unlock(&(st->lock));
+		err = PUBCFS_ERR_WRITEERROR;
+		goto ret4;
+	}
+	pthread_mutex_unlock(&(st->lock));
+
+	if(rename(tmpPath, path) != 0){
+		//the next conversion will complete it
+		err = PUBCFS_ERR_WRITEERROR;
+		close(out);
+		free(o_buf);
+		free(p_buf);
+		free(e_buf);
+		goto ret3;
+	}
+
+	err = PUBCFS_NOERR;
+	close(out);
+	free(o_buf);
+	free(p_buf);
+	free(e_buf);
+	free(tmpPath);
+	close(in);
+	free(path);
+	return err;
+
+	//Errors
+	ret4:
+		free(o_buf);
+		free(p_buf);
+		free(e_buf);
+		close(out);
+		unlink(tmpPath);
+	ret3:
+		free(tmpPath);
+	ret2:
+		close(in);
+	ret1:
+		free(path);
+	ret:
+		return err;
+}
+
+/** Convert a file, it is executed by the threads of the work queue */
+private void pubcfs_resizeWorker(void* arg){
+	pubcfs_resizeJob* job;
+	int ris;
+
+	job = (pubcfs_resizeJob*)arg;
+
+	//after an error the other files are not converted
+	pthread_mutex_lock(&(job->st->lock));
+	ris = job->st->err;
+	pthread_mutex_unlock(&(job->st->lock));
+
+	if(ris == PUBCFS_NOERR){
+		ris = pubcfs_resizeFile(job->st, job->path);
+		pthread_mutex_lock(&(job->st->lock));
+		if(ris == PUBCFS_NOERR) job->st->converted++;
+		else if(job->st->err == PUBCFS_NOERR) job->st->err = ris;
+		pthread_mutex_unlock(&(job->st->lock));
+	}
+
+	free(job->path);
+	free(job);
+}
+
+/** Returns true if an entry of a directory is the temporary file of a conversion interrupted
+ * before the journal: a regular file named PUBCFS_RESIZE_TMP_PREFIX followed by the inode number
+ * of another regular file of the same directory (see pubcfs_resizeTmpPath). The names without the
+ * PUBCFS_FILENAME_ENC prefix are not encrypted, so the other files with PUBCFS_RESIZE_TMP_PREFIX
+ * are files of the user
+ *
+ * @param entries the entries of the directory
+ * @param k the entry to check
+ */
+private bool pubcfs_resizeIsTmp(pubcfs_resizeEntry* entries, size_t count, size_t k){
+	char *digits, *end, canonical[24];
+	ulong ino;
+	size_t i;
+
+	if(!S_ISREG(entries[k].sb.st_mode)) return false;
+	if(strncmp(entries[k].name, PUBCFS_RESIZE_TMP_PREFIX, strlen(PUBCFS_RESIZE_TMP_PREFIX)) != 0){
+		return false;
+	}
+
+	//only the number as it is written by pubcfs_resizeTmpPath
+	digits = entries[k].name + strlen(PUBCFS_RESIZE_TMP_PREFIX);
+	if(*digits < '0' || *digits > '9') return false;
+	errno = 0;
+	ino = strtoul(digits, &end, 10);
+	if(*end != '\0' || errno != 0) return false;
+	sprintf(canonical, "%lu", ino);
+	if(strcmp(canonical, digits) != 0) return false;
+
+	for(i = 0; i < count; i++){
+		if(i != k && S_ISREG(entries[i].sb.st_mode) && (ulong)entries[i].sb.st_ino == ino) return true;
+	}
+
+	return false;
+}
+
+/** Visit a directory and add a job for every file to convert
+ *
+ * All the entries are read before adding the jobs, because the jobs create their temporary files
+ * in the directory. The temporary files of a previous conversion are removed before.
+ *
+ * @param relPath the path of the directory relative to the root path, "" for the root
+ *
+ * @return PUBCFS_NOERR or an error
+ */
+private int pubcfs_resizeWalk(pubcfs_resizeState* st, workQueue_t* q, const char* relPath){
+	DIR* dp;
+	struct dirent* de;
+	pubcfs_resizeEntry *entries, *tmpEntries;
+	size_t count, capacity, k;
+	char *path, *childRelPath;
+	pubcfs_resizeJob* job;
+	int err;
+
+	path = (char*)malloc(strlen(st->rootPath) + strlen(relPath) + 2);
+	if(path == NULL) return PUBCFS_ERR_ENOMEM;
+	sprintf(path, "%s/%s", st->rootPath, relPath);
+
+	dp = opendir(path);
+	if(dp == NULL){
+		free(path);
+		return PUBCFS_ERR_READERROR;
+	}
+
+	err = PUBCFS_NOERR;
+	entries = NULL;
+	count = 0;
+	capacity = 0;
+	while(err == PUBCFS_NOERR && (de = readdir(dp)) != NULL){
+		if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+		//the configuration and the keys are not encrypted with the simmetric key
+		if(relPath[0] == '\0' && strcmp(de->d_name, PUBCFS_CONFIG_FOLDER) == 0) continue;
+
+		if(count == capacity){
+			capacity = (capacity == 0) ? 64 : capacity * 2;
+			tmpEntries = (pubcfs_resizeEntry*)realloc(entries, capacity * sizeof(pubcfs_resizeEntry));
+			if(tmpEntries == NULL){
+				err = PUBCFS_ERR_ENOMEM;
+				break;
+			}
+			entries = tmpEntries;
+		}
+		entries[count].name = strdup(de->d_name);
+		if(entries[count].name == NULL){
+			err = PUBCFS_ERR_ENOMEM;
+		}else if(fstatat(dirfd(dp), de->d_name, &(entries[count].sb), AT_SYMLINK_NOFOLLOW) != 0){
+			free(entries[count].name);
+			err = PUBCFS_ERR_READERROR;
+		}else{
+			count++;
+		}
+	}
+
+	//the temporary files of a conversion interrupted before the journal
+	for(k = 0; err == PUBCFS_NOERR && k < count; k++){
+		entries[k].tmp = pubcfs_resizeIsTmp(entries, count, k);
+	}
+	for(k = 0; err == PUBCFS_NOERR && k < count; k++){
+		if(entries[k].tmp && unlinkat(dirfd(dp), entries[k].name, 0) != 0){
+			err = PUBCFS_ERR_WRITEERROR;
+		}
+	}
+
+	for(k = 0; err == PUBCFS_NOERR && k < count; k++){
+		if(entries[k].tmp) continue;
+		if(!S_ISDIR(entries[k].sb.st_mode) && !S_ISREG(entries[k].sb.st_mode)) continue;
+
+		childRelPath = (char*)malloc(strlen(relPath) + strlen(entries[k].name) + 2);
+		if(childRelPath == NULL){
+			err = PUBCFS_ERR_ENOMEM;
+			break;
+		}
+		if(relPath[0] == '\0') strcpy(childRelPath, entries[k].name);
+		else sprintf(childRelPath, "%s/%s", relPath, entries[k].name);
+
+		if(S_ISDIR(entries[k].sb.st_mode)){
+			err = pubcfs_resizeWalk(st, q, childRelPath);
+		}else if(st->doneCount == 0 || bsearch(&childRelPath, st->done, st->doneCount,
+										sizeof(char*), pubcfs_resizeCompare) == NULL){
+			job = (pubcfs_resizeJob*)malloc(sizeof(pubcfs_resizeJob));
+			if(job == NULL){
+				err = PUBCFS_ERR_ENOMEM;
+			}else{
+				job->st = st;
+				job->path = childRelPath;
+				childRelPath = NULL; //now it is owned by the job
+				if(!workQueue_push(q, pubcfs_resizeWorker, job)){
+					free(job->path);
+					free(job);
+					err = PUBCFS_ERR_ENOMEM;
+				}
+			}
+		}
+
+		free(childRelPath);
+	}
+
+	for(k = 0; k < count; k++) free(entries[k].name);
+	free(entries);
+	closedir(dp);
+	free(path);
+	return err;
+}
+
+/** Read the journal of an interrupted conversion and complete the renames of its files
+ *
+ * @return PUBCFS_NOERR or an error
+ */
+private int pubcfs_resizeRecover(pubcfs_resizeState* st, FILE* journal){
+	char line[PATH_MAX + 32];
+	char *relPath, *path, *tmpPath, **done;
+	size_t len;
+	ulong ino;
+
+	while(fgets(line, sizeof(line), journal) != NULL){
+		len = strlen(line);
+		if(len == 0 || line[len - 1] != '\n') break; //the last line can be incomplete
+		line[len - 1] = '\0';
+		relPath = strchr(line, ' ');
+		if(relPath == NULL) continue;
+		*relPath = '\0';
+		relPath++;
+		ino = strtoul(line, NULL, 10);
+
+		path = (char*)malloc(strlen(st->rootPath) + strlen(relPath) + 2);
+		if(path == NULL) return PUBCFS_ERR_ENOMEM;
+		sprintf(path, "%s/%s", st->rootPath, relPath);
+		tmpPath = pubcfs_resizeTmpPath(path, ino);
+		if(tmpPath == NULL){
+			free(path);
+			return PUBCFS_ERR_ENOMEM;
+		}
+		if(access(tmpPath, F_OK) == 0 && rename(tmpPath, path) != 0){
+			free(tmpPath);
+			free(path);
+			return PUBCFS_ERR_WRITEERROR;
+		}
+		free(tmpPath);
+		free(path);
+
+		done = (char**)realloc(st->done, (st->doneCount + 1) * sizeof(char*));
+		if(done == NULL) return PUBCFS_ERR_ENOMEM;
+		st->done = done;
+		st->done[st->doneCount] = strdup(relPath);
+		if(st->done[st->doneCount] == NULL) return PUBCFS_ERR_ENOMEM;
+		st->doneCount++;
+	}
+
+	if(st->doneCount > 0) qsort(st->done, st->doneCount, sizeof(char*), pubcfs_resizeCompare);
+
+	return PUBCFS_NOERR;
+}
+
+/** Save the new block size into the configuration, the old configuration is replaced with a
+ * rename so it is never partially written */
+private int pubcfs_resizeSaveConfig(char* configFilePath, size_t newBlockSize){
+	char *tmpPath, value[24];
+	mConfig_t* c;
+	int err;
+
+	if(mConfig_readConfig(&c, configFilePath) != MCONFIG_NOERR) return PUBCFS_ERR_BADCONFIGFOLDER;
+
+	tmpPath = (char*)malloc(strlen(configFilePath) + 5);
+	if(tmpPath == NULL){
+		mConfig_dispose(c);
+		return PUBCFS_ERR_ENOMEM;
+	}
+	sprintf(tmpPath, "%s.new", configFilePath);
+
+	sprintf(value, "%lu", (ulong)newBlockSize);
+	mConfig_remove(c, "blocksize");
+	err = PUBCFS_NOERR;
+	if(mConfig_add(c, "blocksize", value) != MCONFIG_NOERR){
+		err = PUBCFS_ERR_ENOMEM;
+	}else if(mConfig_saveConfig(c, tmpPath) != MCONFIG_NOERR || rename(tmpPath, configFilePath) != 0){
+		unlink(tmpPath);
+		err = PUBCFS_ERR_WRITEERROR;
+	}
+
+	free(tmpPath);
+	mConfig_dispose(c);
+	return err;
+}
+
+/** Convert all the files of a folder to a new block size
+ *
+ * The folder must not be mounted, it is locked during the conversion (see pubcfs_lockFolder). If
+ * a previous conversion was interrupted it is completed, but only if it had the same new block
+ * size.
+ *
+ * @param rootPath the path of the crypted folder
+ * @param userName an user of the folder
+ * @param privKey the private key of the user, for reading the simmetric key
+ * @param newBlockSize the new block size
+ * @param threadCount the number of the files converted at the same time
+ * @param fdOut where the progress is written
+ *
+ * @return PUBCFS_NOERR if ok,
+ * 		  PUBCFS_ERR_BADBLOCKSIZE if the new block size is not valid,
+ * 		  PUBCFS_ERR_RESIZEPENDING if there is an interrupted conversion to another block size,
+ * 		  PUBCFS_ERR_MOUNTED if the folder is mounted,
+ * 		  PUBCFS_ERR_BADCONFIGFOLDER if the configuration can't be read,
+ * 		  PUBCFS_ERR_READERROR or PUBCFS_ERR_WRITEERROR if a file can't be converted,
+ * 		  PUBCFS_ERR_ENOMEM if there is not enough memory,
+ * 		  or an error of the pubcfs_readSimmetricKey function
+ */
+int pubcfs_changeBlockSize(char* rootPath, char* userName, RSA* privKey, size_t newBlockSize,
+						   int threadCount, FILE* fdOut){
+	char *configFilePath, *journalPath, *buf;
+	ulong from, to;
+	pubcfs_resizeState st;
+	pubcfs_context ctx;
+	workQueue_t* q;
+	mConfig_t* c;
+	FILE* journal;
+	size_t i;
+	int err, ris, cipher, lockFd;
+
+	if(newBlockSize < PUBCFS_BLOCKSIZE_MIN || newBlockSize > PUBCFS_BLOCKSIZE_MAX){
+		return PUBCFS_ERR_BADBLOCKSIZE;
+	}
+	lockFd = -1;
+
+	configFilePath = (char*)malloc(strlen(rootPath) + strlen(PUBCFS_CONFIG_PATH) + 2);
+	journalPath = (char*)malloc(strlen(rootPath) + strlen(PUBCFS_RESIZE_JOURNAL_PATH) + 2);
+	if(configFilePath == NULL || journalPath == NULL){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret;
+	}
+	sprintf(configFilePath, "%s/%s", rootPath, PUBCFS_CONFIG_PATH);
+	sprintf(journalPath, "%s/%s", rootPath, PUBCFS_RESIZE_JOURNAL_PATH);
+
+	//the current block size
+	if(mConfig_readConfig(&c, configFilePath) != MCONFIG_NOERR){
+		err = PUBCFS_ERR_BADCONFIGFOLDER;
+		goto ret;
+	}
+	//the files keep their cipher, see pubcfs_main_readConfig
+	buf = mConfig_readValue(c, "cipher");
+	cipher = pubcfs_getCipher((buf != NULL) ? buf : PUBCFS_CONFIG_DEFAULT_CIPHER);
+	free(buf);
+	buf = mConfig_readValue(c, "blocksize");
+	mConfig_dispose(c);
+	if(buf == NULL || cipher < 0){
+		free(buf);
+		err = PUBCFS_ERR_BADCONFIGFOLDER;
+		goto ret;
+	}
+	memset(&st, 0, sizeof(pubcfs_resizeState));
+	st.rootPath = rootPath;
+	st.oldBlockSize = atol(buf);
+	st.newBlockSize = newBlockSize;
+	free(buf);
+	if(st.oldBlockSize < PUBCFS_BLOCKSIZE_MIN || st.oldBlockSize > PUBCFS_BLOCKSIZE_MAX){
+		err = PUBCFS_ERR_BADCONFIGFOLDER;
+		goto ret;
+	}
+	if(cipher == PUBCFS_CIPHER_XTS && newBlockSize < 16){
+		err = PUBCFS_ERR_BADBLOCKSIZE;
+		goto ret;
+	}
+
+	//a mounted folder holds the lock
+	lockFd = pubcfs_lockFolder(rootPath);
+	if(lockFd < 0){
+		err = (errno == EWOULDBLOCK) ? PUBCFS_ERR_MOUNTED : PUBCFS_ERR_BADCONFIGFOLDER;
+		goto ret;
+	}
+
+	//an interrupted conversion is completed only if it has the same block sizes
+	journal = fopen(journalPath, "r+");
+	if(journal != NULL){
+		if(fscanf(journal, "%lu %lu\n", &from, &to) != 2 || from != st.oldBlockSize
+		   || to != newBlockSize){
+			fclose(journal);
+			err = PUBCFS_ERR_RESIZEPENDING;
+			goto ret;
+		}
+		fprintf(fdOut, "completing an interrupted conversion\n");
+		err = pubcfs_resizeRecover(&st, journal);
+		if(err != PUBCFS_NOERR){
+			fclose(journal);
+			goto ret1;
+		}
+		//the new entries are appended after the complete lines
+		fseek(journal, 0, SEEK_END);
+	}else{
+		if(st.oldBlockSize == newBlockSize){
+			err = PUBCFS_NOERR;
+			goto ret;
+		}
+		journal = fopen(journalPath, "w");
+		if(journal == NULL){
+			err = PUBCFS_ERR_WRITEERROR;
+			goto ret;
+		}
+		if(fprintf(journal, "%lu %lu\n", (ulong)st.oldBlockSize, (ulong)newBlockSize) < 0
+		   || fflush(journal) != 0 || fsync(fileno(journal)) != 0){
+			fclose(journal);
+			unlink(journalPath);
+			err = PUBCFS_ERR_WRITEERROR;
+			goto ret;
+		}
+	}
+	st.journal = journal;
+
+	//the simmetric key, the crypto contexts of the threads are created from it
+	memset(&ctx, 0, sizeof(pubcfs_context));
+	ctx.cipher = cipher;
+	ctx.keyLen = PUBCFS_SIMMKEY_SIZE;
+	ris = pubcfs_readSimmetricKey(privKey, rootPath, userName, &(ctx.key));
+	if(ris != PUBCFS_NOERR){
+		err = ris;
+		goto ret2;
+	}
+	if(pubcfs_initCryptoPool(&ctx) != 0){
+		memset(ctx.key, 0, ctx.keyLen);
+		free(ctx.key);
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret2;
+	}
+	st.ctx = &ctx;
+	pthread_mutex_init(&(st.lock), NULL);
+	st.err = PUBCFS_NOERR;
+
+	q = workQueue_new(threadCount, 0);
+	if(q == NULL){
+		err = PUBCFS_ERR_ENOMEM;
+		goto ret3;
+	}
+	fprintf(fdOut, "converting from %lu to %lu bytes blocks with %d threads\n",
+			(ulong)st.oldBlockSize, (ulong)newBlockSize, q->threadCount);
+	err = pubcfs_resizeWalk(&st, q, "");
+	if(err != PUBCFS_NOERR){
+		pthread_mutex_lock(&(st.lock));
+		st.err = err; //the waiting jobs do nothing
+		pthread_mutex_unlock(&(st.lock));
+	}
+	workQueue_dispose(q); //it waits all the jobs
+	if(err == PUBCFS_NOERR) err = st.err;
+	fprintf(fdOut, "%lu files converted\n", st.converted);
+	if(err != PUBCFS_NOERR) goto ret3;
+
+	//all the files are converted
+	err = pubcfs_resizeSaveConfig(configFilePath, newBlockSize);
+	if(err != PUBCFS_NOERR) goto ret3;
+	fclose(journal);
+	journal = NULL;
+	unlink(journalPath);
+
+	//Errors
+	ret3:
+		pthread_mutex_destroy(&(st.lock));
+		pubcfs_disposeCryptoPool(&ctx);
+		memset(ctx.key, 0, ctx.keyLen);
+		free(ctx.key);
+	ret2:
+		if(journal != NULL) fclose(journal);
+	ret1:
+		for(i = 0; i < st.doneCount; i++) free(st.done[i]);
+		free(st.done);
+	ret:
+		if(lockFd >= 0) close(lockFd);
+		free(journalPath);
+		free(configFilePath);
+		return err;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file workQueue.c
+ * @brief fixed pool of threads that execute the jobs of a FIFO queue
+*/
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+/*
+ * The jobs are executed in the same order of the push, but with more than one thread two jobs
+ * can run at the same time. When the queue is disposed the jobs already pushed are executed
+ * before the threads exit, so a job can own some resources (like a file descriptor) and release
+ * them at the end.
+ */
+
+#include <workQueue.h>
+
+private void* workQueue_worker(void* arg){
+	workQueue_t* q;
+	workQueueJob_t* job;
+
+	q = (workQueue_t*)arg;
+
+	loop{
+		pthread_mutex_lock(&(q->lock));
+		while(q->head == NULL && !q->stop){
+			pthread_cond_wait(&(q->cond), &(q->lock));
+		}
+		job = q->head;
+		if(job == NULL){ //stopped and nothing to do
+			pthread_mutex_unlock(&(q->lock));
+			return NULL;
+		}
+		q->head = job->next;
+		if(q->head == NULL) q->tail = NULL;
+		q->count--;
+		pthread_mutex_unlock(&(q->lock));
+
+		job->fn(job->arg);
+		free(job);
+	}
+}
+
+/** Create a new queue and start its threads
+ *
+ * @param threadCount the number of the threads that execute the jobs
+ * @param maxJobs the maximum number of waiting jobs accepted by workQueue_tryPush
+ *
+ * @return the queue, or NULL on error
+ */
+workQueue_t* workQueue_new(int threadCount, size_t maxJobs){
+	workQueue_t* q;
+	int i;
+
+	if(threadCount <= 0) return NULL;
+
+	q = (workQueue_t*)malloc(sizeof(workQueue_t) + threadCount * sizeof(pthread_t));
+	if(q == NULL) return NULL;
+
+	pthread_mutex_init(&(q->lock), NULL);
+	pthread_cond_init(&(q->cond), NULL);
+	q->head = NULL;
+	q->tail = NULL;
+	q->count = 0;
+	q->maxJobs = maxJobs;
+	q->stop = false;
+	q->threadCount = 0;
+
+	for(i = 0; i < threadCount; i++){
+		if(pthread_create(&(q->threads[i]), NULL, workQueue_worker, q) != 0) break;
+		q->threadCount++;
+	}
+	if(q->threadCount == 0){
+		workQueue_dispose(q);
+		return NULL;
+	}
+
+	return q;
+}
+
+/** Execute the waiting jobs, stop the threads and dispose the queue */
+void workQueue_dispose(workQueue_t* q){
+	int i;
+
+	if(q == NULL) return;
+
+	pthread_mutex_lock(&(q->lock));
+	q->stop = true;
+	pthread_cond_broadcast(&(q->cond));
+	pthread_mutex_unlock(&(q->lock));
+
+	for(i = 0; i < q->threadCount; i++){
+		pthread_join(q->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&(q->cond));
+	pthread_mutex_destroy(&(q->lock));
+	free(q);
+}
+
+private bool workQueue_add(workQueue_t* q, workQueue_fn fn, void* arg, bool bounded){
+	workQueueJob_t* job;
+
+	job = (workQueueJob_t*)malloc(sizeof(workQueueJob_t));
+	if(job == NULL) return false;
+	job->fn = fn;
+	job->arg = arg;
+	job->next = NULL;
+
+	pthread_mutex_lock(&(q->lock));
+	if(q->stop || (bounded && q->count >= q->maxJobs)){
+		pthread_mutex_unlock(&(q->lock));
+		free(job);
+		return false;
+	}
+	if(q->tail == NULL){
+		q->head = job;
+	}else{
+		q->tail->next = job;
+	}
+	q->tail = job;
+	q->count++;
+	pthread_cond_signal(&(q->cond));
+	pthread_mutex_unlock(&(q->lock));
+
+	return true;
+}
+
+/** Add a job to the queue
+ *
+ * @return false if there is not enough memory or the queue is disposing, in this case the job
+ * will never be executed
+ */
+bool workQueue_push(workQueue_t* q, workQueue_fn fn, void* arg){
+	return workQueue_add(q, fn, arg, false);
+}
+
+/** Add a job to the queue only if there are less than maxJobs waiting jobs, it is used for the
+ * jobs that can be dropped when the threads are busy
+ *
+ * @return false if the job was not added
+ */
+bool workQueue_tryPush(workQueue_t* q, workQueue_fn fn, void* arg){
+	return workQueue_add(q, fn, arg, true);
+}
@@ -0,0 +1,50 @@
+/**
+ * @file workQueue.h
+ * @brief fixed pool of threads that execute the jobs of a FIFO queue
+*/
+/*
+ * Copyright 2010 Miro Mannino <miro.mannino@gmail.com>
+ * This work is licensed under the Creative Commons Attribution 2.5
+ * Italy License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by/2.5/it/ or send a letter
+ * to Creative Commons, 171 Second Street, Suite 300, San Francisco,
+ * California, 94105, USA.
+ *
+ */
+
+#ifndef WORKQUEUE_H
+
+	#define WORKQUEUE_H
+
+	#include <stdlib.h>
+	#include <pthread.h>
+	#include <util.h>
+
+	/** The function executed by a worker, arg is the pointer given to workQueue_push */
+	typedef void (*workQueue_fn)(void* arg);
+
+	typedef struct str_workQueueJob{
+		workQueue_fn fn;
+		void* arg;
+		struct str_workQueueJob* next;
+	} workQueueJob_t;
+
+	typedef struct {
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+		workQueueJob_t* head;
+		workQueueJob_t* tail;
+		size_t count;
+		size_t maxJobs; //limit for workQueue_tryPush
+		bool stop;
+		int threadCount;
+		pthread_t threads[];
+	} workQueue_t;
+
+	workQueue_t* workQueue_new(int threadCount, size_t maxJobs);
+	void workQueue_dispose(workQueue_t* q);
+
+	bool workQueue_push(workQueue_t* q, workQueue_fn fn, void* arg);
+	bool workQueue_tryPush(workQueue_t* q, workQueue_fn fn, void* arg);
+
+#endif
@@ -12,6 +12,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 /* this code will be used for test the base64 algorithms */
 /* for use this test 
@@ -19,6 +20,64 @@
 	./a.out
 */
 
+/* compare the SIMD implementations of the filename safe alphabet with the scalar one, the
+ * encoded strings are decoded with an extraneous symbol too */
+int compareImpl(){
+	int impl, i, j, y, errors;
+	uchar a[600], e1[900], e2[900], d1[700], d2[700];
+	size_t len1, len2, len3, len4;
+	bool ris1, ris2;
+	const char extraneous[] = "\n =+/.";
+
+	errors = 0;
+	for(impl = base64_IMPL_SSE41; impl <= base64_IMPL_AVX512VBMI; impl++){
+		if(base64_useImpl(impl) != impl){
+			printf("implementation %d not supported\n", impl);
+			continue;
+		}
+		printf("implementation %d\n", impl);
+
+		for(j=0; j<400; j++){
+			for(i=0; i<20; i++){
+				for(y=0; y<j; y++) a[y] = (uchar)rand();
+
+				base64_useImpl(base64_IMPL_SCALAR);
+				base64_encodeBuf(a, e1, j, &len1, base64_OPT_FILENAMESAFE);
+				base64_useImpl(impl);
+				base64_encodeBuf(a, e2, j, &len2, base64_OPT_FILENAMESAFE);
+				if(len1 != len2 || strcmp((char*)e1, (char*)e2) != 0){
+					printf("Error: encode of %d bytes, impl %d\n  %s\n  %s\n", j, impl, e1, e2);
+					errors++;
+					continue;
+				}
+
+				//an extraneous symbol in a random position
+				if(i % 2 == 1 && len1 > 0){
+					y = rand() % len1;
+					memmove(e1 + y + 1, e1 + y, len1 - y + 1);
+					e1[y] = extraneous[rand() % (sizeof(extraneous) - 1)];
+					len1++;
+				}
+
+				base64_useImpl(base64_IMPL_SCALAR);
+				ris1 = base64_decodeBuf(e1, d1, len1, &len3, base64_OPT_FILENAMESAFE);
+				base64_useImpl(impl);
+				ris2 = base64_decodeBuf(e1, d2, len1, &len4, base64_OPT_FILENAMESAFE);
+				if(ris1 != ris2 || (ris1 && (len3 != len4 || memcmp(d1, d2, len3) != 0))){
+					printf("Error: decode of %s, impl %d\n", e1, impl);
+					errors++;
+				}else if(i % 2 == 0 && j > 0 && (!ris2 || len4 != (size_t)j || memcmp(a, d2, j) != 0)){
+					printf("Error: decode of %s is not the original, impl %d\n", e1, impl);
+					errors++;
+				}
+			}
+		}
+	}
+
+	base64_useImpl(base64_IMPL_AVX512VBMI);
+	return errors;
+}
+
 int main(){
 	int i,j,y;
 	uchar *a, *b, *c;
@@ -26,6 +85,7 @@ int main(){
 	base64_opt_t opt;
 	
 	srand(time(NULL));
+	if(compareImpl() != 0) return 1;
 	a = malloc(1000);
 	
 	for(j=170; j<1000; j++){
@@ -60,12 +120,12 @@ int main(){
 			}
 			
 			//printf("decoded = %s\n", c);
-			if(len2 != j){
+			if(len2 != (size_t)j){
 				printf("Error: len2 != j\n");
 				
 				for(y=0; y<j; y++) printf("%d ", a[y]);
 				printf("\n\n");
-				for(y=0; y<len2; y++) printf("%d ", c[y]);
+				for(y=0; (size_t)y<len2; y++) printf("%d ", c[y]);
 				printf("\n\n");
 				
 				printf("  len2 = %u\n", (uint)len2);